@@ -0,0 +1,181 @@
+/**
+ * @file aesd-circular-buffer-bench.c
+ * @brief Microbenchmarks of the circular buffer, reporting nanoseconds per operation.
+ *
+ * Built by the top level CMake project as aesd-circular-buffer-bench and run by unit-test.sh.
+ * Usage: aesd-circular-buffer-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "aesd-circular-buffer.h"
+
+#define DEFAULT_ITERATIONS   (2000000)
+#define ENTRY_SIZE           (64)
+
+/* results are accumulated here so the compiler cannot drop the measured calls */
+static volatile size_t sink;
+
+static char entry_data[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED][ENTRY_SIZE];
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double start_ns, long ops)
+{
+    printf("%-40s %10.2f ns/op\n", name, (now_ns() - start_ns) / ops);
+}
+
+/**
+ * @brief Fills @param buffer with @param depth entries of ENTRY_SIZE bytes
+ */
+static void fill_buffer(struct aesd_circular_buffer *buffer, int depth)
+{
+    struct aesd_buffer_entry entry;
+    int index = 0;
+
+    aesd_circular_buffer_init(buffer);
+    for (index = 0; index < depth; index++)
+    {
+        entry.buffptr = entry_data[index];
+        entry.size = ENTRY_SIZE;
+        aesd_circular_buffer_add_entry(buffer, &entry);
+    }
+}
+
+static void bench_add_entry(long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry entry;
+    double start_ns = 0;
+    long i = 0;
+
+    aesd_circular_buffer_init(&buffer);
+    entry.size = ENTRY_SIZE;
+    start_ns = now_ns();
+    for (i = 0; i < iterations; i++)
+    {
+        entry.buffptr = entry_data[i % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        sink += (size_t)aesd_circular_buffer_add_entry(&buffer, &entry);
+    }
+    report("add_entry", start_ns, iterations);
+}
+
+static void bench_find_fpos(long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_offset = 0;
+    size_t char_offset = 0;
+    double start_ns = 0;
+    char name[64];
+    int depth = 0;
+    int position = 0;
+    long i = 0;
+    static const char *position_name[] = { "first", "middle", "last" };
+
+    for (depth = 1; depth <= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; depth++)
+    {
+        fill_buffer(&buffer, depth);
+        for (position = 0; position < 3; position++)
+        {
+            /* first byte, middle byte and last byte of the buffer contents */
+            char_offset = (size_t)depth * ENTRY_SIZE * position / 2;
+            if (2 == position)
+            {
+                char_offset = (size_t)depth * ENTRY_SIZE - 1;
+            }
+            start_ns = now_ns();
+            for (i = 0; i < iterations; i++)
+            {
+                entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, char_offset, &entry_offset);
+                sink += entry_offset + (size_t)entry;
+            }
+            snprintf(name, sizeof(name), "find_fpos depth=%d %s", depth, position_name[position]);
+            report(name, start_ns, iterations);
+        }
+    }
+}
+
+static void bench_iterate(long iterations)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry *entry = NULL;
+    struct aesd_iovec iov[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t entry_offset = 0;
+    size_t char_offset = 0;
+    size_t total_bytes = 0;
+    double start_ns = 0;
+    long passes = iterations / AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    long i = 0;
+    uint8_t index = 0;
+
+    /* a full ring that wrapped, so out_offs is not at the start of the array */
+    fill_buffer(&buffer, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    for (index = 0; index < AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED / 2; index++)
+    {
+        aesd_circular_buffer_add_entry(&buffer, &buffer.entry[buffer.in_offs]);
+    }
+
+    /* the way the driver read path walks the history, one entry per lookup */
+    start_ns = now_ns();
+    for (i = 0; i < passes; i++)
+    {
+        char_offset = 0;
+        while (NULL != (entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, char_offset,
+                                                                                 &entry_offset)))
+        {
+            char_offset += entry->size - entry_offset;
+        }
+        sink += char_offset;
+    }
+    report("full history by fpos lookups", start_ns, passes);
+
+    start_ns = now_ns();
+    for (i = 0; i < passes; i++)
+    {
+        sink += aesd_circular_buffer_fill_iovec(&buffer, 0, iov, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED,
+                                                &total_bytes);
+        sink += total_bytes;
+    }
+    report("full history by fill_iovec", start_ns, passes);
+
+    start_ns = now_ns();
+    for (i = 0; i < passes; i++)
+    {
+        AESD_CIRCULAR_BUFFER_FOREACH(entry, &buffer, index)
+        {
+            sink += entry->size;
+        }
+    }
+    report("full history by FOREACH (physical order)", start_ns, passes);
+}
+
+int main(int argc, char *argv[])
+{
+    long iterations = DEFAULT_ITERATIONS;
+
+    if (argc > 1)
+    {
+        iterations = strtol(argv[1], NULL, 0);
+        if (iterations <= 0)
+        {
+            fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    memset(entry_data, 'x', sizeof(entry_data));
+    printf("aesd-circular-buffer-bench: %ld iterations, %d byte entries\n", iterations, ENTRY_SIZE);
+    bench_add_entry(iterations);
+    bench_find_fpos(iterations);
+    bench_iterate(iterations);
+    return EXIT_SUCCESS;
+}
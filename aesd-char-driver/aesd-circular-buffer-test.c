@@ -0,0 +1,222 @@
+/**
+ * @file aesd-circular-buffer-test.c
+ * @brief Tests of the circular buffer APIs added for the driver: count, sequence numbers, lookups by
+ * sequence number and time, removal and the iovec descriptions, including the wrapped state an
+ * arena leaves behind once it removed entries.
+ *
+ * Built by the top level CMake project as aesd-circular-buffer-test, run by ctest and unit-test.sh.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesd-circular-buffer.h"
+
+#define MAX_ENTRIES   AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+/* contents of entry n are strings[n], n + 1 bytes long so offsets tell entries apart */
+static const char *strings[] = {
+    "a\n", "bb\n", "ccc\n", "dddd\n", "eeeee\n", "ffffff\n", "ggggggg\n", "hhhhhhhh\n",
+    "iiiiiiiii\n", "jjjjjjjjjj\n", "kkkkkkkkkkk\n", "llllllllllll\n", "mmmmmmmmmmmmm\n",
+};
+
+/**
+ * @brief Adds strings[@param seq] to @param buffer, committed at time 100 * seq
+ */
+static const char *add_string(struct aesd_circular_buffer *buffer, uint64_t seq)
+{
+    struct aesd_buffer_entry entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.buffptr = strings[seq];
+    entry.size = strlen(strings[seq]);
+    entry.timestamp_ns = 100 * seq;
+    return aesd_circular_buffer_add_entry(buffer, &entry);
+}
+
+/**
+ * @brief Checks every lookup of @param buffer against the entries first_seq..next_seq-1 it should
+ * hold, in order
+ */
+static void check_contents(struct aesd_circular_buffer *buffer, uint64_t first_seq, uint64_t next_seq)
+{
+    struct aesd_iovec iov[MAX_ENTRIES];
+    struct aesd_buffer_entry *entry = NULL;
+    size_t start = 0;
+    size_t offset = 0;
+    size_t total = 0;
+    size_t filled = 0;
+    uint64_t seq = 0;
+
+    CHECK(next_seq - first_seq == aesd_circular_buffer_count(buffer));
+    CHECK(first_seq == aesd_circular_buffer_first_seq(buffer));
+    CHECK(NULL == aesd_circular_buffer_find_entry_for_seq(buffer, next_seq, NULL));
+    if (first_seq > 0)
+    {
+        CHECK(NULL == aesd_circular_buffer_find_entry_for_seq(buffer, first_seq - 1, NULL));
+    }
+
+    filled = aesd_circular_buffer_fill_iovec(buffer, 0, iov, MAX_ENTRIES, &total);
+    CHECK(next_seq - first_seq == filled);
+    for (seq = first_seq; seq < next_seq; seq++)
+    {
+        entry = aesd_circular_buffer_find_entry_for_seq(buffer, seq, &start);
+        CHECK(NULL != entry);
+        CHECK(seq == entry->seq);
+        CHECK(strings[seq] == entry->buffptr);
+        CHECK(offset == start);
+
+        /* the first and the last byte of every entry resolve to it */
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, offset, &start);
+        CHECK((NULL != entry) && (seq == entry->seq) && (0 == start));
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, offset + entry->size - 1, &start);
+        CHECK((NULL != entry) && (seq == entry->seq) && (entry->size - 1 == start));
+
+        /* the time of an entry and any time after the previous one find it */
+        entry = aesd_circular_buffer_find_entry_for_time(buffer, 100 * seq, &start);
+        CHECK((NULL != entry) && (seq == entry->seq) && (offset == start));
+        if (seq > first_seq)
+        {
+            entry = aesd_circular_buffer_find_entry_for_time(buffer, 100 * seq - 50, NULL);
+            CHECK((NULL != entry) && (seq == entry->seq));
+        }
+
+        CHECK(strings[seq] == iov[seq - first_seq].iov_base);
+        CHECK(strlen(strings[seq]) == iov[seq - first_seq].iov_len);
+        offset += strlen(strings[seq]);
+    }
+    CHECK(offset == total);
+    CHECK(NULL == aesd_circular_buffer_find_entry_offset_for_fpos(buffer, offset, &start));
+    CHECK(NULL == aesd_circular_buffer_find_entry_for_time(buffer, 100 * next_seq, NULL));
+    CHECK(0 == aesd_circular_buffer_fill_iovec(buffer, offset, iov, MAX_ENTRIES, &total));
+    CHECK(0 == total);
+}
+
+static void test_empty(void)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_iovec iov[1];
+    size_t total = 1;
+
+    aesd_circular_buffer_init(&buffer);
+    check_contents(&buffer, 0, 0);
+    CHECK(NULL == aesd_circular_buffer_remove_entry(&buffer));
+    CHECK(NULL == aesd_circular_buffer_find_entry_for_time(&buffer, 0, NULL));
+    CHECK(0 == aesd_circular_buffer_fill_iovec_at_entry(&buffer, 0, iov, 1, &total));
+    CHECK(0 == total);
+    CHECK(NULL == aesd_circular_buffer_remove_entry(NULL));
+    CHECK(NULL == aesd_circular_buffer_find_entry_for_seq(NULL, 0, NULL));
+    CHECK(NULL == aesd_circular_buffer_find_entry_for_time(NULL, 0, NULL));
+    CHECK(0 == aesd_circular_buffer_fill_iovec(NULL, 0, iov, 1, NULL));
+    printf("empty: ok\n");
+}
+
+static void test_fill_and_evict(void)
+{
+    struct aesd_circular_buffer buffer;
+    uint64_t seq = 0;
+
+    aesd_circular_buffer_init(&buffer);
+    for (seq = 0; seq < MAX_ENTRIES; seq++)
+    {
+        CHECK(NULL == add_string(&buffer, seq));
+        check_contents(&buffer, 0, seq + 1);
+    }
+    CHECK(buffer.full);
+    /* every add to a full buffer hands back the evicted entry */
+    CHECK(strings[0] == add_string(&buffer, MAX_ENTRIES));
+    CHECK(strings[1] == add_string(&buffer, MAX_ENTRIES + 1));
+    check_contents(&buffer, 2, MAX_ENTRIES + 2);
+    printf("fill and evict: ok\n");
+}
+
+static void test_remove_and_wrap(void)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry *entry = NULL;
+    uint64_t seq = 0;
+
+    aesd_circular_buffer_init(&buffer);
+    for (seq = 0; seq < MAX_ENTRIES; seq++)
+    {
+        add_string(&buffer, seq);
+    }
+    /* removals leave in_offs below out_offs while the buffer is not full */
+    for (seq = 0; seq < 3; seq++)
+    {
+        entry = aesd_circular_buffer_remove_entry(&buffer);
+        CHECK((NULL != entry) && (seq == entry->seq));
+        check_contents(&buffer, seq + 1, MAX_ENTRIES);
+    }
+    CHECK(NULL == add_string(&buffer, MAX_ENTRIES));
+    CHECK(buffer.in_offs < buffer.out_offs);
+    CHECK(!buffer.full);
+    check_contents(&buffer, 3, MAX_ENTRIES + 1);
+
+    /* filling the removed slots again makes it full, the next add evicts the oldest */
+    CHECK(NULL == add_string(&buffer, MAX_ENTRIES + 1));
+    CHECK(NULL == add_string(&buffer, MAX_ENTRIES + 2));
+    CHECK(buffer.full);
+    check_contents(&buffer, 3, MAX_ENTRIES + 3);
+
+    /* emptied by removals, the sequence numbers keep counting */
+    while (NULL != aesd_circular_buffer_remove_entry(&buffer))
+    {
+    }
+    check_contents(&buffer, MAX_ENTRIES + 3, MAX_ENTRIES + 3);
+    printf("remove and wrap: ok\n");
+}
+
+static void test_fill_iovec_partial(void)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_iovec iov[MAX_ENTRIES];
+    size_t total = 0;
+    uint64_t seq = 0;
+
+    aesd_circular_buffer_init(&buffer);
+    for (seq = 0; seq < MAX_ENTRIES + 2; seq++)
+    {
+        add_string(&buffer, seq);
+    }
+    aesd_circular_buffer_remove_entry(&buffer);
+    /* entries 3.. are live: "dddd\n" "eeeee\n" ..., offset 2 lands inside the first one */
+    CHECK(MAX_ENTRIES - 1 == aesd_circular_buffer_fill_iovec(&buffer, 2, iov, MAX_ENTRIES, &total));
+    CHECK(strings[3] + 2 == iov[0].iov_base);
+    CHECK(3 == iov[0].iov_len);
+    CHECK(strings[4] == iov[1].iov_base);
+
+    /* offset 5 is the first byte of entry 4, spans that do not fit are left out */
+    CHECK(2 == aesd_circular_buffer_fill_iovec(&buffer, 5, iov, 2, &total));
+    CHECK(strings[4] == iov[0].iov_base);
+    CHECK(strings[5] == iov[1].iov_base);
+    CHECK(strlen(strings[4]) + strlen(strings[5]) == total);
+
+    CHECK(3 == aesd_circular_buffer_fill_iovec_at_entry(&buffer, MAX_ENTRIES - 4, iov, MAX_ENTRIES, &total));
+    CHECK(strings[MAX_ENTRIES - 1] == iov[0].iov_base);
+    CHECK(strings[MAX_ENTRIES + 1] == iov[2].iov_base);
+    CHECK(strlen(strings[MAX_ENTRIES - 1]) + strlen(strings[MAX_ENTRIES]) +
+          strlen(strings[MAX_ENTRIES + 1]) == total);
+    CHECK(0 == aesd_circular_buffer_fill_iovec_at_entry(&buffer, MAX_ENTRIES - 1, iov, MAX_ENTRIES, &total));
+    CHECK(0 == aesd_circular_buffer_fill_iovec(&buffer, 0, NULL, 0, &total));
+    printf("fill iovec: ok\n");
+}
+
+int main(void)
+{
+    test_empty();
+    test_fill_and_evict();
+    test_remove_and_wrap();
+    test_fill_iovec_partial();
+    return EXIT_SUCCESS;
+}
@@ -38,14 +38,8 @@ struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct
     {
         return NULL;
     }
-    if (buffer->full)
-    {
-        count = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    }
-    else
-    {
-        count = buffer->in_offs - buffer->out_offs;
-    }
+    /* in_offs may be below out_offs once entries were removed, only walk the live ones */
+    count = aesd_circular_buffer_count(buffer);
     while (count > 0)
     {
         total_size += buffer->entry[index].size;
@@ -98,6 +92,7 @@ const char * aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
         }
     }
     memcpy(&buffer->entry[buffer->in_offs], add_entry, sizeof(struct aesd_buffer_entry));
+    buffer->entry[buffer->in_offs].seq = buffer->next_seq++;
     if (buffer->in_offs >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED-1)
     {
         buffer->in_offs = 0;
@@ -118,6 +113,33 @@ const char * aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
     return free_buffptr;
 }
 
+/**
+* Removes the oldest entry from @param buffer, advancing buffer->out_offs.
+* Any necessary locking must be handled by the caller
+* @return the removed entry, which stays valid until the next call to aesd_circular_buffer_add_entry,
+* or NULL if the buffer was empty.  The caller owns any memory referenced by it.
+*/
+struct aesd_buffer_entry *aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer)
+{
+    struct aesd_buffer_entry *removed_entry = NULL;
+
+    if ((NULL == buffer) || (0 == aesd_circular_buffer_count(buffer)))
+    {
+        return NULL;
+    }
+    removed_entry = &buffer->entry[buffer->out_offs];
+    if (buffer->out_offs >= AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED-1)
+    {
+        buffer->out_offs = 0;
+    }
+    else
+    {
+        buffer->out_offs++;
+    }
+    buffer->full = false;
+    return removed_entry;
+}
+
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
 */
@@ -125,3 +147,202 @@ void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
 }
+
+/**
+* @return the number of valid entries currently stored in @param buffer
+* Any necessary locking must be handled by the caller
+*/
+uint8_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full)
+    {
+        return AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    return (buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs) %
+           AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+}
+
+/**
+* @return the sequence number of the oldest entry in @param buffer, or buffer->next_seq when the
+* buffer is empty.  Every sequence number below this value has been evicted.
+* Any necessary locking must be handled by the caller
+*/
+uint64_t aesd_circular_buffer_first_seq(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->next_seq - aesd_circular_buffer_count(buffer);
+}
+
+/**
+ * @param buffer the buffer to search.  Any necessary locking must be performed by caller.
+ * @param seq the sequence number of the entry to locate
+ * @param entry_start_byte_rtn is a pointer specifying a location to store the zero referenced character
+ *      index of the first byte of the returned entry, if all buffer strings were concatenated end to end.
+ *      May be NULL.  This value is only set when the entry is found.
+ * @return the struct aesd_buffer_entry with sequence number seq, or NULL if the entry has already been
+ * evicted or has not been written yet.
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_find_entry_for_seq(struct aesd_circular_buffer *buffer,
+            uint64_t seq, size_t *entry_start_byte_rtn )
+{
+    uint64_t first_seq = 0;
+    uint8_t index = 0;
+    uint8_t count = 0;
+    size_t total_size = 0;
+
+    if (NULL == buffer)
+    {
+        return NULL;
+    }
+    first_seq = aesd_circular_buffer_first_seq(buffer);
+    if ((seq < first_seq) || (seq >= buffer->next_seq))
+    {
+        return NULL;
+    }
+    index = buffer->out_offs;
+    for (count = (uint8_t)(seq - first_seq); count > 0; count--)
+    {
+        total_size += buffer->entry[index].size;
+        index = (index + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    }
+    if (NULL != entry_start_byte_rtn)
+    {
+        *entry_start_byte_rtn = total_size;
+    }
+    return &buffer->entry[index];
+}
+
+/**
+ * @param buffer the buffer to search.  Any necessary locking must be performed by caller.
+ *      Entry timestamps must not decrease from the oldest entry to the newest.
+ * @param timestamp_ns the earliest commit time of interest
+ * @param entry_start_byte_rtn is a pointer specifying a location to store the zero referenced character
+ *      index of the first byte of the returned entry, if all buffer strings were concatenated end to end.
+ *      May be NULL.  This value is only set when the entry is found.
+ * @return the oldest struct aesd_buffer_entry committed at or after timestamp_ns, found by binary
+ * search, or NULL if every entry is older.
+ */
+struct aesd_buffer_entry *aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer,
+            uint64_t timestamp_ns, size_t *entry_start_byte_rtn )
+{
+    uint8_t low = 0;
+    uint8_t high = 0;
+    uint8_t middle = 0;
+
+    if (NULL == buffer)
+    {
+        return NULL;
+    }
+    /* search entries low..high-1, counted from the oldest */
+    high = aesd_circular_buffer_count(buffer);
+    while (low < high)
+    {
+        middle = low + (high - low) / 2;
+        if (buffer->entry[(buffer->out_offs + middle) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].timestamp_ns <
+            timestamp_ns)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return aesd_circular_buffer_find_entry_for_seq(buffer, aesd_circular_buffer_first_seq(buffer) + low,
+                                                   entry_start_byte_rtn);
+}
+
+/**
+* Describes the live entries of @param buffer in logical order, starting @param skip bytes into
+* the entry @param entry_index positions after the oldest one, in at most @param iov_count
+* members of @param iov.
+*/
+static size_t aesd_circular_buffer_fill_iovec_from(const struct aesd_circular_buffer *buffer,
+            uint8_t entry_index, size_t skip, struct aesd_iovec *iov, size_t iov_count,
+            size_t *total_bytes_rtn )
+{
+    const struct aesd_buffer_entry *entry = NULL;
+    uint8_t count = aesd_circular_buffer_count(buffer);
+    size_t filled = 0;
+    size_t total_bytes = 0;
+
+    for (; (entry_index < count) && (filled < iov_count); entry_index++)
+    {
+        entry = &buffer->entry[(buffer->out_offs + entry_index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        /* entries are never written through the spans, writev and sendmsg only read them */
+        iov[filled].iov_base = (void *)(entry->buffptr + skip);
+        iov[filled].iov_len = entry->size - skip;
+        total_bytes += entry->size - skip;
+        filled++;
+        skip = 0;
+    }
+    if (NULL != total_bytes_rtn)
+    {
+        *total_bytes_rtn = total_bytes;
+    }
+    return filled;
+}
+
+/**
+ * @param buffer the buffer to describe.  Any necessary locking must be performed by caller, and the
+ *      spans are only valid as long as the entries stay in the buffer.
+ * @param char_offset the position of the first byte to describe, the zero referenced character index
+ *      if all buffer strings were concatenated end to end
+ * @param iov the array to fill with one span per entry, in logical order from the oldest entry.  The
+ *      first span starts at char_offset and may cover only the end of its entry.
+ * @param iov_count the number of members of iov, entries that do not fit are left out
+ * @param total_bytes_rtn is a pointer specifying a location to store the number of bytes described
+ *      by the filled spans.  May be NULL.
+ * @return the number of members of iov filled in, 0 if char_offset is at or past the end of the buffer.
+ */
+size_t aesd_circular_buffer_fill_iovec(const struct aesd_circular_buffer *buffer,
+            size_t char_offset, struct aesd_iovec *iov, size_t iov_count, size_t *total_bytes_rtn )
+{
+    uint8_t count = 0;
+    uint8_t entry_index = 0;
+    size_t entry_size = 0;
+
+    if (NULL != total_bytes_rtn)
+    {
+        *total_bytes_rtn = 0;
+    }
+    if ((NULL == buffer) || ((NULL == iov) && (0 != iov_count)))
+    {
+        return 0;
+    }
+    count = aesd_circular_buffer_count(buffer);
+    for (entry_index = 0; entry_index < count; entry_index++)
+    {
+        entry_size = buffer->entry[(buffer->out_offs + entry_index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size;
+        if (char_offset < entry_size)
+        {
+            return aesd_circular_buffer_fill_iovec_from(buffer, entry_index, char_offset, iov, iov_count,
+                                                        total_bytes_rtn);
+        }
+        char_offset -= entry_size;
+    }
+    return 0;
+}
+
+/**
+ * @param buffer the buffer to describe.  Any necessary locking must be performed by caller, and the
+ *      spans are only valid as long as the entries stay in the buffer.
+ * @param entry_index the zero referenced index of the first entry to describe, counted from the oldest
+ * @param iov the array to fill with one span per entry, in logical order
+ * @param iov_count the number of members of iov, entries that do not fit are left out
+ * @param total_bytes_rtn is a pointer specifying a location to store the number of bytes described
+ *      by the filled spans.  May be NULL.
+ * @return the number of members of iov filled in, 0 if entry_index is past the newest entry.
+ */
+size_t aesd_circular_buffer_fill_iovec_at_entry(const struct aesd_circular_buffer *buffer,
+            uint8_t entry_index, struct aesd_iovec *iov, size_t iov_count, size_t *total_bytes_rtn )
+{
+    if (NULL != total_bytes_rtn)
+    {
+        *total_bytes_rtn = 0;
+    }
+    if ((NULL == buffer) || ((NULL == iov) && (0 != iov_count)))
+    {
+        return 0;
+    }
+    return aesd_circular_buffer_fill_iovec_from(buffer, entry_index, 0, iov, iov_count, total_bytes_rtn);
+}
@@ -10,10 +10,16 @@
 
 #ifdef __KERNEL__
 #include <linux/types.h>
+#include <linux/uio.h>
+/* kernel callers hand the spans to kernel_sendmsg/iov_iter_kvec */
+#define aesd_iovec kvec
 #else
 #include <stddef.h> // size_t
 #include <stdint.h> // uintx_t
 #include <stdbool.h>
+#include <sys/uio.h> // struct iovec
+/* user space callers hand the spans to writev/sendmsg */
+#define aesd_iovec iovec
 #endif
 
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
@@ -28,6 +34,16 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Sequence number assigned by aesd_circular_buffer_add_entry, increasing by one for every
+     * entry ever added to the buffer.  Survives eviction of older entries.
+     */
+    uint64_t seq;
+    /**
+     * Time the entry was committed, in nanoseconds since the epoch.  Set by the caller, which
+     * must keep it from decreasing for aesd_circular_buffer_find_entry_for_time to work.
+     */
+    uint64_t timestamp_ns;
 };
 
 struct aesd_circular_buffer
@@ -49,6 +65,10 @@ struct aesd_circular_buffer
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * The sequence number the next added entry will receive
+     */
+    uint64_t next_seq;
 };
 
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
@@ -56,8 +76,26 @@ extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos
 
 extern const char * aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const struct aesd_buffer_entry *add_entry);
 
+extern struct aesd_buffer_entry *aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer);
+
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern uint8_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer);
+
+extern uint64_t aesd_circular_buffer_first_seq(const struct aesd_circular_buffer *buffer);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_for_seq(struct aesd_circular_buffer *buffer,
+            uint64_t seq, size_t *entry_start_byte_rtn );
+
+extern size_t aesd_circular_buffer_fill_iovec(const struct aesd_circular_buffer *buffer,
+            size_t char_offset, struct aesd_iovec *iov, size_t iov_count, size_t *total_bytes_rtn );
+
+extern size_t aesd_circular_buffer_fill_iovec_at_entry(const struct aesd_circular_buffer *buffer,
+            uint8_t entry_index, struct aesd_iovec *iov, size_t iov_count, size_t *total_bytes_rtn );
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_for_time(struct aesd_circular_buffer *buffer,
+            uint64_t timestamp_ns, size_t *entry_start_byte_rtn );
+
 /**
  * Create a for loop to iterate over each member of the circular buffer.
  * Useful when you've allocated memory for circular buffer entries and need to free it
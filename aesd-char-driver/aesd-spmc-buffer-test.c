@@ -0,0 +1,217 @@
+/**
+ * @file aesd-spmc-buffer-test.c
+ * @brief Tests of the single producer, multiple consumer buffer, including a concurrency test
+ * where consumers chase a producer that keeps overwriting the entries they copy.
+ *
+ * Built by the top level CMake project as aesd-spmc-buffer-test, run by ctest and unit-test.sh.
+ * Usage: aesd-spmc-buffer-test [entries]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aesd-spmc-buffer.h"
+
+#define DEFAULT_ENTRIES   (500000)
+#define CONSUMER_COUNT    (4)
+/* small enough that the producer overwrites data consumers are copying */
+#define DATA_AREA_SIZE    (1024)
+#define MAX_ENTRY_SIZE    (128)
+/* the producer lets consumers run this often, so they interleave even on a single CPU */
+#define YIELD_INTERVAL    (16)
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) \
+        { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+typedef struct consumer {
+    pthread_t thread;
+    uint64_t copied;
+    uint64_t overwritten;
+    uint64_t corrupted;
+} consumer_t;
+
+static struct aesd_spmc_buffer buffer;
+static char data_area[DATA_AREA_SIZE];
+static uint64_t entry_count = DEFAULT_ENTRIES;
+
+/**
+ * @brief Size of entry @param seq, at least room for its sequence number
+ */
+static size_t entry_size(uint64_t seq)
+{
+    return sizeof(seq) + (seq % (MAX_ENTRY_SIZE - sizeof(seq)));
+}
+
+/**
+ * @brief Fills @param dest with the contents of entry @param seq: its sequence number followed
+ * by bytes derived from it, so a torn copy of two entries never checks out
+ */
+static size_t entry_fill(uint64_t seq, char *dest)
+{
+    size_t size = entry_size(seq);
+    size_t index = 0;
+
+    memcpy(dest, &seq, sizeof(seq));
+    for (index = sizeof(seq); index < size; index++)
+    {
+        dest[index] = (char)(seq * 31 + index);
+    }
+    return size;
+}
+
+static void test_single_thread(void)
+{
+    char expected[MAX_ENTRY_SIZE];
+    char copy[MAX_ENTRY_SIZE];
+    size_t size = 0;
+    uint64_t seq = 0;
+
+    aesd_spmc_buffer_init(&buffer, data_area, DATA_AREA_SIZE);
+    CHECK(0 == aesd_spmc_buffer_next_seq(&buffer));
+    CHECK(0 == aesd_spmc_buffer_first_seq(&buffer));
+    CHECK(AESD_SPMC_NOT_YET == aesd_spmc_buffer_read(&buffer, 0, copy, sizeof(copy), &size));
+    CHECK(-1 == aesd_spmc_buffer_push(&buffer, copy, 0));
+    CHECK(-1 == aesd_spmc_buffer_push(&buffer, copy, DATA_AREA_SIZE + 1));
+    CHECK(AESD_SPMC_INVALID == aesd_spmc_buffer_read(&buffer, 0, NULL, sizeof(copy), &size));
+
+    for (seq = 0; seq < 3; seq++)
+    {
+        size = entry_fill(seq, expected);
+        CHECK(0 == aesd_spmc_buffer_push(&buffer, expected, size));
+    }
+    CHECK(3 == aesd_spmc_buffer_next_seq(&buffer));
+    for (seq = 0; seq < 3; seq++)
+    {
+        CHECK(AESD_SPMC_OK == aesd_spmc_buffer_read(&buffer, seq, copy, sizeof(copy), &size));
+        CHECK(size == entry_fill(seq, expected));
+        CHECK(0 == memcmp(copy, expected, size));
+    }
+    /* entry 2 holds 10 bytes */
+    CHECK(AESD_SPMC_TOO_SMALL == aesd_spmc_buffer_read(&buffer, 2, copy, 4, &size));
+    CHECK(entry_size(2) == size);
+
+    /* slot reuse evicts entries once more than AESD_SPMC_SLOTS were pushed */
+    for (seq = 3; seq < AESD_SPMC_SLOTS + 3; seq++)
+    {
+        size = entry_fill(seq, expected);
+        CHECK(0 == aesd_spmc_buffer_push(&buffer, expected, size));
+    }
+    CHECK(3 == aesd_spmc_buffer_first_seq(&buffer));
+    CHECK(AESD_SPMC_OVERWRITTEN == aesd_spmc_buffer_read(&buffer, 2, copy, sizeof(copy), &size));
+    CHECK(AESD_SPMC_OK == aesd_spmc_buffer_read(&buffer, 3, copy, sizeof(copy), &size));
+
+    /* data wrapping around the end of the area evicts by position as well */
+    for (seq = AESD_SPMC_SLOTS + 3; seq < 4 * AESD_SPMC_SLOTS; seq++)
+    {
+        size = entry_fill(seq, expected);
+        CHECK(0 == aesd_spmc_buffer_push(&buffer, expected, size));
+    }
+    for (seq = aesd_spmc_buffer_first_seq(&buffer); seq < aesd_spmc_buffer_next_seq(&buffer); seq++)
+    {
+        if (AESD_SPMC_OK == aesd_spmc_buffer_read(&buffer, seq, copy, sizeof(copy), &size))
+        {
+            CHECK(size == entry_fill(seq, expected));
+            CHECK(0 == memcmp(copy, expected, size));
+        }
+    }
+    CHECK(AESD_SPMC_OK == aesd_spmc_buffer_read(&buffer, 4 * AESD_SPMC_SLOTS - 1, copy,
+                                                sizeof(copy), &size));
+    printf("single thread: ok\n");
+}
+
+/**
+ * @brief Reads every entry it can catch up with, checking each successful copy
+ */
+static void *consumer_thread(void *arg)
+{
+    consumer_t *consumer = arg;
+    char expected[MAX_ENTRY_SIZE];
+    char copy[MAX_ENTRY_SIZE];
+    size_t size = 0;
+    uint64_t seq = 0;
+    uint64_t first_seq = 0;
+
+    while (seq < entry_count)
+    {
+        switch (aesd_spmc_buffer_read(&buffer, seq, copy, sizeof(copy), &size))
+        {
+            case AESD_SPMC_OK:
+            if ((size != entry_fill(seq, expected)) || (0 != memcmp(copy, expected, size)))
+            {
+                consumer->corrupted++;
+            }
+            consumer->copied++;
+            seq++;
+            break;
+
+            case AESD_SPMC_OVERWRITTEN:
+            consumer->overwritten++;
+            first_seq = aesd_spmc_buffer_first_seq(&buffer);
+            seq = (first_seq > seq) ? first_seq : seq + 1;
+            break;
+
+            case AESD_SPMC_NOT_YET:
+            sched_yield();
+            break;
+
+            default:
+            consumer->corrupted++;
+            seq++;
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void test_concurrent(void)
+{
+    consumer_t consumers[CONSUMER_COUNT];
+    char entry[MAX_ENTRY_SIZE];
+    uint64_t seq = 0;
+    int index = 0;
+
+    aesd_spmc_buffer_init(&buffer, data_area, DATA_AREA_SIZE);
+    memset(consumers, 0, sizeof(consumers));
+    for (index = 0; index < CONSUMER_COUNT; index++)
+    {
+        CHECK(0 == pthread_create(&consumers[index].thread, NULL, consumer_thread, &consumers[index]));
+    }
+    for (seq = 0; seq < entry_count; seq++)
+    {
+        CHECK(0 == aesd_spmc_buffer_push(&buffer, entry, entry_fill(seq, entry)));
+        if (0 == (seq % YIELD_INTERVAL))
+        {
+            sched_yield();
+        }
+    }
+    for (index = 0; index < CONSUMER_COUNT; index++)
+    {
+        CHECK(0 == pthread_join(consumers[index].thread, NULL));
+        printf("consumer %d: %llu copied, %llu overwritten\n", index,
+               (unsigned long long)consumers[index].copied,
+               (unsigned long long)consumers[index].overwritten);
+        CHECK(0 == consumers[index].corrupted);
+        CHECK(consumers[index].copied > 0);
+    }
+    printf("concurrent: ok\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        entry_count = strtoull(argv[1], NULL, 0);
+    }
+    test_single_thread();
+    test_concurrent();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,183 @@
+/**
+ * @file aesd-spmc-buffer.c
+ * @brief Single producer, multiple consumer variant of the circular buffer, see
+ * aesd-spmc-buffer.h
+ *
+ * Consumers copy data the producer may be overwriting at the same time and validate the copy
+ * afterwards, the way a seqlock reader does.  The producer raises reclaim_pos before it
+ * overwrites any byte and marks a slot odd before it changes it, so a copy is good if the
+ * slot still holds the same sequence and the data was above reclaim_pos once it was taken.
+ *
+ */
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/compiler.h>
+#include <asm/barrier.h>
+#define aesd_load_acquire(p) smp_load_acquire(p)
+#define aesd_store_release(p, v) smp_store_release(p, v)
+#define aesd_load_relaxed(p) READ_ONCE(*(p))
+#define aesd_store_relaxed(p, v) WRITE_ONCE(*(p), v)
+/* orders the data copy before the validating loads */
+#define aesd_fence_read() smp_rmb()
+/* orders the invalidating stores before the data stores */
+#define aesd_fence_write() smp_wmb()
+#else
+#include <string.h>
+#define aesd_load_acquire(p) atomic_load_explicit(p, memory_order_acquire)
+#define aesd_store_release(p, v) atomic_store_explicit(p, v, memory_order_release)
+#define aesd_load_relaxed(p) atomic_load_explicit(p, memory_order_relaxed)
+#define aesd_store_relaxed(p, v) atomic_store_explicit(p, v, memory_order_relaxed)
+#define aesd_fence_read() atomic_thread_fence(memory_order_acquire)
+#define aesd_fence_write() atomic_thread_fence(memory_order_release)
+#endif
+
+#include "aesd-spmc-buffer.h"
+
+/**
+* Initializes @param buffer to an empty buffer storing entry data in the @param data_size bytes
+* at @param data, which must stay valid while the buffer is used.
+* Must complete before the producer or any consumer uses the buffer.
+*/
+void aesd_spmc_buffer_init(struct aesd_spmc_buffer *buffer, char *data, size_t data_size)
+{
+    memset(buffer, 0, sizeof(struct aesd_spmc_buffer));
+    buffer->data = data;
+    buffer->data_size = data_size;
+}
+
+/**
+* Appends a copy of the @param size bytes at @param data as the newest entry of @param buffer,
+* evicting the oldest entries as needed.  Only one thread may call this at a time.
+* @return 0 on success, -1 if size is zero or larger than the data area.
+*/
+int aesd_spmc_buffer_push(struct aesd_spmc_buffer *buffer, const char *data, size_t size)
+{
+    struct aesd_spmc_slot *slot = NULL;
+    uint64_t seq = 0;
+    uint64_t pos = 0;
+    size_t index = 0;
+    size_t first_part = 0;
+
+    if ((NULL == buffer) || (NULL == data) || (0 == size) || (size > buffer->data_size))
+    {
+        return -1;
+    }
+    seq = aesd_load_relaxed(&buffer->next_seq);
+    pos = buffer->write_pos;
+    slot = &buffer->slot[seq % AESD_SPMC_SLOTS];
+
+    /* invalidate the evicted slot and the bytes about to be overwritten first */
+    aesd_store_relaxed(&slot->seq, 2 * seq + 1);
+    if ((pos + size) > buffer->data_size)
+    {
+        aesd_store_relaxed(&buffer->reclaim_pos, pos + size - buffer->data_size);
+    }
+    aesd_fence_write();
+
+    index = pos % buffer->data_size;
+    first_part = buffer->data_size - index;
+    if (first_part >= size)
+    {
+        memcpy(buffer->data + index, data, size);
+    }
+    else
+    {
+        memcpy(buffer->data + index, data, first_part);
+        memcpy(buffer->data, data + first_part, size - first_part);
+    }
+    aesd_store_relaxed(&slot->pos, pos);
+    aesd_store_relaxed(&slot->size, size);
+    buffer->write_pos = pos + size;
+
+    /* complete the slot, then make the entry visible to consumers looking for new entries */
+    aesd_store_release(&slot->seq, 2 * seq + 2);
+    aesd_store_release(&buffer->next_seq, seq + 1);
+    return 0;
+}
+
+/**
+* @return the sequence number the next entry pushed to @param buffer will receive.  Every entry
+* below it was complete when this was called.
+*/
+uint64_t aesd_spmc_buffer_next_seq(struct aesd_spmc_buffer *buffer)
+{
+    return aesd_load_acquire(&buffer->next_seq);
+}
+
+/**
+* @return the sequence number of the oldest entry @param buffer still has a slot for.  Its data
+* may already be overwritten, which aesd_spmc_buffer_read reports.
+*/
+uint64_t aesd_spmc_buffer_first_seq(struct aesd_spmc_buffer *buffer)
+{
+    uint64_t next_seq = aesd_spmc_buffer_next_seq(buffer);
+
+    return (next_seq > AESD_SPMC_SLOTS) ? (next_seq - AESD_SPMC_SLOTS) : 0;
+}
+
+/**
+* Copies the entry with sequence number @param seq of @param buffer to the @param dest_size bytes
+* at @param dest without blocking the producer.
+* @param size_rtn is set to the size of the entry on AESD_SPMC_OK and AESD_SPMC_TOO_SMALL.
+* @return AESD_SPMC_OK if dest holds a consistent copy of the entry, AESD_SPMC_NOT_YET if it is
+* not complete yet, AESD_SPMC_OVERWRITTEN if the producer evicted it before or during the copy.
+*/
+enum aesd_spmc_status aesd_spmc_buffer_read(struct aesd_spmc_buffer *buffer, uint64_t seq,
+            char *dest, size_t dest_size, size_t *size_rtn)
+{
+    struct aesd_spmc_slot *slot = NULL;
+    uint64_t slot_seq = 0;
+    uint64_t pos = 0;
+    size_t size = 0;
+    size_t index = 0;
+    size_t first_part = 0;
+
+    if ((NULL == buffer) || (NULL == size_rtn) || ((NULL == dest) && (0 != dest_size)))
+    {
+        return AESD_SPMC_INVALID;
+    }
+    if (seq >= aesd_spmc_buffer_next_seq(buffer))
+    {
+        return AESD_SPMC_NOT_YET;
+    }
+    slot = &buffer->slot[seq % AESD_SPMC_SLOTS];
+    slot_seq = aesd_load_acquire(&slot->seq);
+    if (slot_seq != (2 * seq + 2))
+    {
+        return AESD_SPMC_OVERWRITTEN;
+    }
+    pos = aesd_load_relaxed(&slot->pos);
+    size = aesd_load_relaxed(&slot->size);
+    if (pos < aesd_load_relaxed(&buffer->reclaim_pos))
+    {
+        return AESD_SPMC_OVERWRITTEN;
+    }
+    if (size > dest_size)
+    {
+        *size_rtn = size;
+        return AESD_SPMC_TOO_SMALL;
+    }
+
+    index = pos % buffer->data_size;
+    first_part = buffer->data_size - index;
+    if (first_part >= size)
+    {
+        memcpy(dest, buffer->data + index, size);
+    }
+    else
+    {
+        memcpy(dest, buffer->data + index, first_part);
+        memcpy(dest + first_part, buffer->data, size - first_part);
+    }
+
+    /* the copy is only good if nothing was invalidated while it was taken */
+    aesd_fence_read();
+    if ((aesd_load_relaxed(&slot->seq) != slot_seq) ||
+        (pos < aesd_load_relaxed(&buffer->reclaim_pos)))
+    {
+        return AESD_SPMC_OVERWRITTEN;
+    }
+    *size_rtn = size;
+    return AESD_SPMC_OK;
+}
@@ -0,0 +1,108 @@
+/*
+ * aesd-spmc-buffer.h
+ *
+ * @brief Ring of recent entries with one producer and any number of lock free consumers.
+ *
+ * Unlike struct aesd_circular_buffer, which needs the caller to lock around every call, the
+ * producer appends without waiting for consumers and consumers copy entries out without
+ * blocking the producer.  Entry data is copied into a byte area owned by the buffer, so
+ * nothing a consumer reads is ever freed.  A consumer that is overtaken by the producer
+ * notices it through sequence checks and reports the entry as overwritten.
+ *
+ * Built with C11 atomics in user space and with the kernel barrier primitives in kernel
+ * space.  Both need 64 bit atomic loads and stores.
+ */
+
+#ifndef AESD_SPMC_BUFFER_H
+#define AESD_SPMC_BUFFER_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/cache.h>
+#define AESD_SPMC_CACHELINE SMP_CACHE_BYTES
+typedef uint64_t aesd_spmc_atomic_t;
+#else
+#include <stddef.h> // size_t
+#include <stdint.h> // uintx_t
+#include <stdatomic.h>
+#define AESD_SPMC_CACHELINE 64
+typedef _Atomic uint64_t aesd_spmc_atomic_t;
+#endif
+
+#include "aesd-circular-buffer.h"
+
+#define AESD_SPMC_SLOTS AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+
+/**
+ * Results of aesd_spmc_buffer_read
+ */
+enum aesd_spmc_status
+{
+    AESD_SPMC_OK = 0,
+    AESD_SPMC_NOT_YET = 1,      /* the entry has not been written yet */
+    AESD_SPMC_OVERWRITTEN = 2,  /* the entry was evicted, its data may be gone */
+    AESD_SPMC_TOO_SMALL = 3,    /* the destination cannot hold the entry, nothing copied */
+    AESD_SPMC_INVALID = 4,      /* invalid arguments */
+};
+
+/**
+ * Location of one entry, each slot on its own cache line so the producer filling one slot
+ * does not disturb consumers reading the others
+ */
+struct aesd_spmc_slot
+{
+    /**
+     * 2 * sequence number + 2 once the entry is complete, odd while the producer fills the slot,
+     * 0 if the slot was never used
+     */
+    aesd_spmc_atomic_t seq;
+    /**
+     * Byte position of the first data byte, counted since the buffer was initialized
+     */
+    aesd_spmc_atomic_t pos;
+    /**
+     * Number of data bytes
+     */
+    aesd_spmc_atomic_t size;
+} __attribute__((aligned(AESD_SPMC_CACHELINE)));
+
+struct aesd_spmc_buffer
+{
+    /**
+     * The sequence number the next entry will receive, published after the entry is complete
+     */
+    aesd_spmc_atomic_t next_seq __attribute__((aligned(AESD_SPMC_CACHELINE)));
+    /**
+     * Data bytes at positions below this one may be overwritten, raised before they are
+     */
+    aesd_spmc_atomic_t reclaim_pos;
+    /**
+     * Position following the newest entry, only used by the producer
+     */
+    uint64_t write_pos __attribute__((aligned(AESD_SPMC_CACHELINE)));
+    /**
+     * Storage for entry data, set at initialization and read only afterwards
+     */
+    char *data __attribute__((aligned(AESD_SPMC_CACHELINE)));
+    /**
+     * Number of bytes at data
+     */
+    size_t data_size;
+    /**
+     * Entry sequence number n is described by slot[n % AESD_SPMC_SLOTS]
+     */
+    struct aesd_spmc_slot slot[AESD_SPMC_SLOTS];
+};
+
+extern void aesd_spmc_buffer_init(struct aesd_spmc_buffer *buffer, char *data, size_t data_size);
+
+extern int aesd_spmc_buffer_push(struct aesd_spmc_buffer *buffer, const char *data, size_t size);
+
+extern uint64_t aesd_spmc_buffer_next_seq(struct aesd_spmc_buffer *buffer);
+
+extern uint64_t aesd_spmc_buffer_first_seq(struct aesd_spmc_buffer *buffer);
+
+extern enum aesd_spmc_status aesd_spmc_buffer_read(struct aesd_spmc_buffer *buffer, uint64_t seq,
+            char *dest, size_t dest_size, size_t *size_rtn);
+
+#endif /* AESD_SPMC_BUFFER_H */
@@ -0,0 +1,142 @@
+/*
+ * aesd-trace.h
+ *
+ * @brief Tracepoints of the aesdchar driver, found under events/aesdchar in tracefs.
+ * Defined by main.c, which sets CREATE_TRACE_POINTS before including this header.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define AESD_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * One or more entries published to the ring under a single acquisition of dev->lock
+ */
+TRACE_EVENT(aesd_commit,
+    TP_PROTO(unsigned int minor, u64 seq, unsigned int count, size_t bytes,
+             u64 wait_ns, u64 held_ns),
+    TP_ARGS(minor, seq, count, bytes, wait_ns, held_ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, seq)
+        __field(unsigned int, count)
+        __field(size_t, bytes)
+        __field(u64, wait_ns)
+        __field(u64, held_ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->seq = seq;
+        __entry->count = count;
+        __entry->bytes = bytes;
+        __entry->wait_ns = wait_ns;
+        __entry->held_ns = held_ns;
+    ),
+    TP_printk("minor=%u seq=%llu count=%u bytes=%zu wait_ns=%llu held_ns=%llu",
+              __entry->minor, __entry->seq, __entry->count, __entry->bytes,
+              __entry->wait_ns, __entry->held_ns)
+);
+
+/**
+ * Bytes of one entry copied to a reader, held_ns covers the file lock up to the copy
+ */
+TRACE_EVENT(aesd_read,
+    TP_PROTO(unsigned int minor, u64 seq, size_t entry_offset, size_t bytes, u64 held_ns),
+    TP_ARGS(minor, seq, entry_offset, bytes, held_ns),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, seq)
+        __field(size_t, entry_offset)
+        __field(size_t, bytes)
+        __field(u64, held_ns)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->seq = seq;
+        __entry->entry_offset = entry_offset;
+        __entry->bytes = bytes;
+        __entry->held_ns = held_ns;
+    ),
+    TP_printk("minor=%u seq=%llu entry_offset=%zu bytes=%zu held_ns=%llu",
+              __entry->minor, __entry->seq, __entry->entry_offset, __entry->bytes,
+              __entry->held_ns)
+);
+
+/**
+ * An entry dropped from the ring to make room for a newer one
+ */
+TRACE_EVENT(aesd_evict,
+    TP_PROTO(unsigned int minor, u64 seq, size_t size),
+    TP_ARGS(minor, seq, size),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u64, seq)
+        __field(size_t, size)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->seq = seq;
+        __entry->size = size;
+    ),
+    TP_printk("minor=%u seq=%llu size=%zu", __entry->minor, __entry->seq, __entry->size)
+);
+
+/**
+ * llseek on the device, result is the new position or an error code
+ */
+TRACE_EVENT(aesd_llseek,
+    TP_PROTO(unsigned int minor, loff_t offset, int whence, loff_t result),
+    TP_ARGS(minor, offset, whence, result),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(loff_t, offset)
+        __field(int, whence)
+        __field(loff_t, result)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->offset = offset;
+        __entry->whence = whence;
+        __entry->result = result;
+    ),
+    TP_printk("minor=%u offset=%lld whence=%d result=%lld",
+              __entry->minor, __entry->offset, __entry->whence, __entry->result)
+);
+
+/**
+ * AESDCHAR_IOCSEEKTO, pos is the file position afterwards
+ */
+TRACE_EVENT(aesd_seekto,
+    TP_PROTO(unsigned int minor, u32 write_cmd, u32 write_cmd_offset, loff_t pos, long result),
+    TP_ARGS(minor, write_cmd, write_cmd_offset, pos, result),
+    TP_STRUCT__entry(
+        __field(unsigned int, minor)
+        __field(u32, write_cmd)
+        __field(u32, write_cmd_offset)
+        __field(loff_t, pos)
+        __field(long, result)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->write_cmd = write_cmd;
+        __entry->write_cmd_offset = write_cmd_offset;
+        __entry->pos = pos;
+        __entry->result = result;
+    ),
+    TP_printk("minor=%u write_cmd=%u write_cmd_offset=%u pos=%lld result=%ld",
+              __entry->minor, __entry->write_cmd, __entry->write_cmd_offset,
+              __entry->pos, __entry->result)
+);
+
+#endif /* AESD_TRACE_H */
+
+/* the driver is built out of tree, tell define_trace.h where to find this header */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesd-trace
+#include <trace/define_trace.h>
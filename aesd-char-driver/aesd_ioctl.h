@@ -33,14 +33,271 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * A structure returned by IOCTL from kernel space to user space, describing the read position
+ * of a file descriptor in terms of entry sequence numbers
+ */
+struct aesd_cursor {
+    /**
+     * The sequence number of the entry the next read starts in
+     */
+    uint64_t seq;
+    /**
+     * The zero referenced offset within that entry
+     */
+    uint64_t entry_offset;
+    /**
+     * The number of entries evicted from the buffer before this file descriptor read them
+     */
+    uint64_t missed;
+};
+
+/**
+ * Number of entries described by struct aesd_mmap_header, matches the size of the circular buffer
+ */
+#define AESD_MMAP_MAX_ENTRIES 10
+
+/**
+ * Location of one entry in the data area of an mmap of the device
+ */
+struct aesd_mmap_entry {
+    /**
+     * The sequence number of the entry
+     */
+    uint64_t seq;
+    /**
+     * The offset of the entry from the start of the data area
+     */
+    uint64_t offset;
+    /**
+     * The number of bytes in the entry
+     */
+    uint64_t size;
+};
+
+/**
+ * Layout of the first page of a read only mmap of the device, the data area follows at the
+ * next page.  Only devices using arena storage (aesd_arena_size module parameter) can be mapped.
+ *
+ * generation is odd while the driver updates the header.  Readers copy the header, retry if
+ * generation was odd or changed meanwhile, then copy entry data and discard entries whose
+ * sequence number is below a first_seq read afterwards, since those may have been overwritten.
+ */
+struct aesd_mmap_header {
+    /**
+     * Incremented before and after every update of the header
+     */
+    uint32_t generation;
+    /**
+     * The number of valid members of entry
+     */
+    uint32_t entry_count;
+    /**
+     * The number of bytes in the data area
+     */
+    uint64_t data_size;
+    /**
+     * The data area offset of the oldest entry
+     */
+    uint64_t head;
+    /**
+     * The data area offset following the newest entry
+     */
+    uint64_t tail;
+    /**
+     * The sequence number of the oldest entry, data of older entries may be overwritten
+     */
+    uint64_t first_seq;
+    /**
+     * The sequence number the next entry will receive
+     */
+    uint64_t next_seq;
+    /**
+     * The entries from oldest to newest
+     */
+    struct aesd_mmap_entry entry[AESD_MMAP_MAX_ENTRIES];
+};
+
+/**
+ * Maximum number of records accepted by one AESDCHAR_IOCWRBATCH
+ */
+#define AESD_WRITE_BATCH_MAX 64
+
+/**
+ * One command of a batched write
+ */
+struct aesd_write_record {
+    /**
+     * User space address of the command bytes
+     */
+    uint64_t buf;
+    /**
+     * The number of bytes in the command, not zero
+     */
+    uint64_t len;
+};
+
+/**
+ * A structure to be passed by IOCTL from user space to kernel space, describing commands
+ * to add to the buffer in one call.  Each record becomes one entry as is, whether or not it
+ * ends with a new line, and independent of any unterminated command written to the file.
+ * Either all records are added, in order, or none.
+ */
+struct aesd_write_batch {
+    /**
+     * User space address of an array of count struct aesd_write_record
+     */
+    uint64_t records;
+    /**
+     * The number of records, at most AESD_WRITE_BATCH_MAX
+     */
+    uint32_t count;
+    /**
+     * Reserved, must be zero
+     */
+    uint32_t flags;
+};
+
+/**
+ * Description of one entry in the buffer, filled in by AESDCHAR_IOCGENTRIES
+ */
+struct aesd_entry_info {
+    /**
+     * The sequence number of the entry
+     */
+    uint64_t seq;
+    /**
+     * The file offset of the first byte of the entry
+     */
+    uint64_t offset;
+    /**
+     * The number of bytes in the entry
+     */
+    uint64_t size;
+    /**
+     * The time the entry was committed, in nanoseconds since the epoch
+     */
+    uint64_t timestamp_ns;
+};
+
+/**
+ * A structure passed by IOCTL between user space and kernel space to read the table of
+ * entries currently in the buffer, oldest first
+ */
+struct aesd_entry_table {
+    /**
+     * User space address of an array of capacity struct aesd_entry_info
+     */
+    uint64_t entries;
+    /**
+     * The number of members of entries, at most this many are filled in
+     */
+    uint32_t capacity;
+    /**
+     * Set to the number of entries in the buffer, which may exceed capacity
+     */
+    uint32_t count;
+};
+
+/**
+ * A structure to be passed by IOCTL from user space to kernel space, describing a seek to
+ * the first entry committed at or after a point in time
+ */
+struct aesd_seektime {
+    /**
+     * Nanoseconds since the epoch, compared with struct aesd_entry_info timestamp_ns
+     */
+    uint64_t timestamp_ns;
+};
+
+/**
+ * First bytes of a snapshot, "AESD" in little endian byte order
+ */
+#define AESD_SNAPSHOT_MAGIC 0x44534541
+#define AESD_SNAPSHOT_VERSION 1
+
+/**
+ * Start of a snapshot of the buffer, followed by entry_count entries from oldest to newest,
+ * each a struct aesd_snapshot_entry immediately followed by its size bytes of data
+ */
+struct aesd_snapshot_header {
+    /**
+     * AESD_SNAPSHOT_MAGIC
+     */
+    uint32_t magic;
+    /**
+     * AESD_SNAPSHOT_VERSION
+     */
+    uint32_t version;
+    /**
+     * The number of entries in the snapshot, at most AESD_MMAP_MAX_ENTRIES, the buffer capacity
+     */
+    uint32_t entry_count;
+    /**
+     * Reserved, zero
+     */
+    uint32_t reserved;
+    /**
+     * The sequence number the next entry written after the snapshot receives
+     */
+    uint64_t next_seq;
+};
+
+/**
+ * One entry of a snapshot, the entries of a snapshot have consecutive sequence numbers
+ */
+struct aesd_snapshot_entry {
+    /**
+     * The sequence number of the entry
+     */
+    uint64_t seq;
+    /**
+     * The time the entry was committed, in nanoseconds since the epoch
+     */
+    uint64_t timestamp_ns;
+    /**
+     * The number of data bytes following this structure
+     */
+    uint64_t size;
+};
+
+/**
+ * A structure passed by IOCTL between user space and kernel space, naming a user buffer
+ * holding a snapshot of the device
+ */
+struct aesd_snapshot {
+    /**
+     * User space address of the snapshot
+     */
+    uint64_t buf;
+    /**
+     * The number of bytes at buf.  AESDCHAR_IOCSNAPSHOT sets it to the size of the
+     * snapshot, and fails with ENOSPC without writing buf if that is larger.
+     */
+    uint64_t len;
+};
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+// Read the sequence based cursor of a file descriptor, command number 2
+#define AESDCHAR_IOCGCURSOR _IOR(AESD_IOC_MAGIC, 2, struct aesd_cursor)
+// Add a batch of commands, returns the number added, command number 3
+#define AESDCHAR_IOCWRBATCH _IOW(AESD_IOC_MAGIC, 3, struct aesd_write_batch)
+// Read the table of entries in the buffer, command number 4
+#define AESDCHAR_IOCGENTRIES _IOWR(AESD_IOC_MAGIC, 4, struct aesd_entry_table)
+// Seek to the first entry committed at or after a time, or to the end if there is none,
+// command number 5
+#define AESDCHAR_IOCSEEKTIME _IOW(AESD_IOC_MAGIC, 5, struct aesd_seektime)
+// Export the entries of the buffer as a snapshot, command number 6
+#define AESDCHAR_IOCSNAPSHOT _IOWR(AESD_IOC_MAGIC, 6, struct aesd_snapshot)
+// Import a snapshot into a device nothing was written to yet, command number 7
+#define AESDCHAR_IOCRESTORE _IOW(AESD_IOC_MAGIC, 7, struct aesd_snapshot)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 7
 
 #endif /* AESD_IOCTL_H */
@@ -0,0 +1,653 @@
+/**
+ * @file aesdchar-emu.c
+ * @brief User space emulation of the aesdchar device, loaded with LD_PRELOAD.
+ *
+ * Opening the device path, /dev/aesdchar or $AESDCHAR_EMU_PATH, returns a descriptor whose
+ * read, write, lseek, ioctl and close calls are served from an in process circular buffer
+ * with the semantics of the driver: writes accumulate per open file until a new line
+ * commits them as an entry, the buffer keeps the last AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED
+ * entries, and reads follow a per file cursor on entry sequence numbers, so a reader resumes
+ * in the same entry after older ones were evicted and counts the entries it missed.  llseek
+ * works on the concatenated entries, AESDCHAR_IOCSEEKTO positions the file within an entry.
+ * AESDCHAR_IOCGCURSOR, AESDCHAR_IOCWRBATCH, AESDCHAR_IOCGENTRIES and AESDCHAR_IOCSEEKTIME
+ * are supported as well, AESDCHAR_IOCSNAPSHOT and AESDCHAR_IOCRESTORE fail with ENOTTY.
+ * A command left unterminated by a closed file is continued by the next file opened for
+ * writing.  This lets aesdsocket run with USE_AESD_CHAR_DEVICE without loading the module:
+ *
+ *     LD_PRELOAD=build/libaesdchar-emu.so ./server/aesdsocket
+ *
+ * The buffer lives as long as the process.  Calls on emulated devices are serialized by one
+ * mutex, calls on other descriptors are passed through without taking it.
+ */
+
+#define _GNU_SOURCE /* RTLD_NEXT */
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+
+#include "aesd-circular-buffer.h"
+#include "aesd_ioctl.h"
+
+/* Macro definitions */
+
+#define DEFAULT_DEVICE_PATH   "/dev/aesdchar"
+#define MAX_EMULATED_FDS      (1024)
+
+/* Per open file state, like struct aesd_file in the driver */
+typedef struct emu_file {
+    off_t pos;          /* file position, f_pos of the driver */
+    uint64_t seq;       /* sequence number of the entry the read cursor is in */
+    size_t entry_offset; /* byte offset of the read cursor within that entry */
+    off_t cursor_pos;   /* file position produced by the last read */
+    bool cursor_valid;  /* false once the file is repositioned, seq is then derived from pos */
+    uint64_t missed;    /* entries evicted before this file could read them */
+    char *pending;      /* unterminated command written so far */
+    size_t pending_size;
+} emu_file_t;
+
+/* Global definitions */
+static pthread_mutex_t emu_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct aesd_circular_buffer emu_buffer;
+static emu_file_t emu_files[MAX_EMULATED_FDS];
+/* set while a descriptor is an emulated device, read without emu_lock */
+static atomic_bool emu_used[MAX_EMULATED_FDS];
+static char *emu_pending;        /* unterminated command left by a closed file */
+static size_t emu_pending_size;
+static const char *emu_device_path = DEFAULT_DEVICE_PATH;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static off_t (*real_lseek)(int, off_t, int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static ssize_t (*real_splice)(int, loff_t *, int, loff_t *, size_t, unsigned int);
+
+__attribute__((constructor))
+static void emu_init(void)
+{
+    const char *path = getenv("AESDCHAR_EMU_PATH");
+
+    if (NULL != path)
+    {
+        emu_device_path = path;
+    }
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_close = dlsym(RTLD_NEXT, "close");
+    real_read = dlsym(RTLD_NEXT, "read");
+    real_write = dlsym(RTLD_NEXT, "write");
+    real_lseek = dlsym(RTLD_NEXT, "lseek");
+    real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+    real_splice = dlsym(RTLD_NEXT, "splice");
+    aesd_circular_buffer_init(&emu_buffer);
+}
+
+/**
+ * @brief Returns the emulation state of @param fd, or NULL if it is not an emulated device.
+ * Caller must hold emu_lock.
+ */
+static emu_file_t *emu_file(int fd)
+{
+    if ((fd < 0) || (fd >= MAX_EMULATED_FDS) ||
+        !atomic_load_explicit(&emu_used[fd], memory_order_relaxed))
+    {
+        return NULL;
+    }
+    return &emu_files[fd];
+}
+
+/**
+ * @brief Returns true if @param fd is an emulated device, without taking emu_lock so calls on
+ * other descriptors are never serialized.  Callers look the file up again under the lock,
+ * which catches a device closed meanwhile.
+ */
+static bool emu_is_device(int fd)
+{
+    if ((fd < 0) || (fd >= MAX_EMULATED_FDS))
+    {
+        return false;
+    }
+    return atomic_load_explicit(&emu_used[fd], memory_order_acquire);
+}
+
+/**
+ * @brief Returns the number of bytes stored in the live entries of the buffer.  Caller must
+ * hold emu_lock.
+ */
+static size_t emu_buffer_size(void)
+{
+    uint8_t index = 0;
+    uint8_t count = aesd_circular_buffer_count(&emu_buffer);
+    size_t total_size = 0;
+
+    for (index = 0; index < count; index++)
+    {
+        total_size += emu_buffer.entry[(emu_buffer.out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size;
+    }
+    return total_size;
+}
+
+/**
+ * @brief Returns the commit time for entries added now, never below that of the newest entry
+ * so aesd_circular_buffer_find_entry_for_time keeps working.  Caller must hold emu_lock.
+ */
+static uint64_t emu_commit_time(void)
+{
+    struct timespec now;
+    uint64_t timestamp_ns = 0;
+    const struct aesd_buffer_entry *newest = NULL;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    if (0 != aesd_circular_buffer_count(&emu_buffer))
+    {
+        newest = &emu_buffer.entry[(emu_buffer.in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1) %
+                                   AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        if (newest->timestamp_ns > timestamp_ns)
+        {
+            timestamp_ns = newest->timestamp_ns;
+        }
+    }
+    return timestamp_ns;
+}
+
+/**
+ * @brief Brings the read cursor of @param file in line with its position, like
+ * aesd_sync_cursor in the driver.  While the position is the one produced by the previous
+ * read the cursor is authoritative, otherwise the position is taken as a byte offset into the
+ * buffer.  Entries evicted before the cursor reached them are skipped and counted in missed.
+ * Caller must hold emu_lock.
+ */
+static void emu_sync_cursor(emu_file_t *file)
+{
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_offset = 0;
+    uint64_t first_seq = 0;
+
+    if ((!file->cursor_valid) || (file->pos != file->cursor_pos))
+    {
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&emu_buffer, file->pos, &entry_offset);
+        if (NULL != entry)
+        {
+            file->seq = entry->seq;
+            file->entry_offset = entry_offset;
+        }
+        else
+        {
+            /* past the end, wait for the next entry */
+            file->seq = emu_buffer.next_seq;
+            file->entry_offset = 0;
+        }
+        file->cursor_valid = true;
+    }
+    first_seq = aesd_circular_buffer_first_seq(&emu_buffer);
+    if (file->seq < first_seq)
+    {
+        file->missed += first_seq - file->seq;
+        file->seq = first_seq;
+        file->entry_offset = 0;
+    }
+}
+
+/**
+ * @brief Opens an emulated device, reserving the descriptor number with /dev/null
+ */
+static int emu_open(int flags)
+{
+    int fd = real_open("/dev/null", flags & O_ACCMODE);
+    emu_file_t *file = NULL;
+
+    if (fd < 0)
+    {
+        return fd;
+    }
+    if (fd >= MAX_EMULATED_FDS)
+    {
+        real_close(fd);
+        errno = EMFILE;
+        return -1;
+    }
+    pthread_mutex_lock(&emu_lock);
+    file = &emu_files[fd];
+    memset(file, 0, sizeof(emu_file_t));
+    /* continue a command left unterminated by a file that was closed */
+    if (O_RDONLY != (flags & O_ACCMODE))
+    {
+        file->pending = emu_pending;
+        file->pending_size = emu_pending_size;
+        emu_pending = NULL;
+        emu_pending_size = 0;
+    }
+    /* published once the state is set up */
+    atomic_store_explicit(&emu_used[fd], true, memory_order_release);
+    pthread_mutex_unlock(&emu_lock);
+    return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    va_list args;
+
+    if ((flags & O_CREAT) || (O_TMPFILE == (flags & O_TMPFILE)))
+    {
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    if (0 == strcmp(path, emu_device_path))
+    {
+        return emu_open(flags);
+    }
+    return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+    va_list args;
+
+    if ((flags & O_CREAT) || (O_TMPFILE == (flags & O_TMPFILE)))
+    {
+        va_start(args, flags);
+        mode = va_arg(args, mode_t);
+        va_end(args);
+    }
+    return open(path, flags, mode);
+}
+
+int close(int fd)
+{
+    emu_file_t *file = NULL;
+    char *pending = NULL;
+
+    if (!emu_is_device(fd))
+    {
+        return real_close(fd);
+    }
+    pthread_mutex_lock(&emu_lock);
+    file = emu_file(fd);
+    if (NULL != file)
+    {
+        if (0 != file->pending_size)
+        {
+            /* hand the unterminated command over to the next writer */
+            pending = realloc(emu_pending, emu_pending_size + file->pending_size);
+            if (NULL != pending)
+            {
+                memcpy(pending + emu_pending_size, file->pending, file->pending_size);
+                emu_pending = pending;
+                emu_pending_size += file->pending_size;
+            }
+        }
+        free(file->pending);
+        atomic_store_explicit(&emu_used[fd], false, memory_order_relaxed);
+        memset(file, 0, sizeof(emu_file_t));
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return real_close(fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+    emu_file_t *file = NULL;
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_start = 0;
+    ssize_t read_bytes = 0;
+
+    if (!emu_is_device(fd))
+    {
+        return real_read(fd, buf, count);
+    }
+    pthread_mutex_lock(&emu_lock);
+    file = emu_file(fd);
+    if (NULL == file)
+    {
+        /* closed by another thread meanwhile */
+        pthread_mutex_unlock(&emu_lock);
+        errno = EBADF;
+        return -1;
+    }
+    emu_sync_cursor(file);
+    entry = aesd_circular_buffer_find_entry_for_seq(&emu_buffer, file->seq, &entry_start);
+    if (NULL == entry)
+    {
+        /* cursor is at the end of the buffer */
+        file->pos = emu_buffer_size();
+    }
+    else
+    {
+        /* like the driver, a read returns data of at most one entry */
+        read_bytes = entry->size - file->entry_offset;
+        if ((size_t)read_bytes > count)
+        {
+            read_bytes = count;
+        }
+        memcpy(buf, entry->buffptr + file->entry_offset, read_bytes);
+        file->entry_offset += read_bytes;
+        if (file->entry_offset >= entry->size)
+        {
+            file->seq++;
+            file->entry_offset = 0;
+            entry_start += entry->size;
+        }
+        file->pos = entry_start + file->entry_offset;
+    }
+    file->cursor_pos = file->pos;
+    pthread_mutex_unlock(&emu_lock);
+    return read_bytes;
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+    emu_file_t *file = NULL;
+    struct aesd_buffer_entry entry;
+    char *pending = NULL;
+    ssize_t written_bytes = count;
+
+    if (!emu_is_device(fd))
+    {
+        return real_write(fd, buf, count);
+    }
+    if (0 == count)
+    {
+        return 0;
+    }
+    pthread_mutex_lock(&emu_lock);
+    file = emu_file(fd);
+    if (NULL == file)
+    {
+        pthread_mutex_unlock(&emu_lock);
+        errno = EBADF;
+        return -1;
+    }
+    pending = realloc(file->pending, file->pending_size + count);
+    if (NULL == pending)
+    {
+        pthread_mutex_unlock(&emu_lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    memcpy(pending + file->pending_size, buf, count);
+    file->pending = pending;
+    file->pending_size += count;
+
+    /* add to circular buffer if command is terminated by new line */
+    if ('\n' == file->pending[file->pending_size - 1])
+    {
+        entry.buffptr = file->pending;
+        entry.size = file->pending_size;
+        entry.timestamp_ns = emu_commit_time();
+        free((char *)aesd_circular_buffer_add_entry(&emu_buffer, &entry));
+        file->pending = NULL;
+        file->pending_size = 0;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return written_bytes;
+}
+
+off_t lseek(int fd, off_t offset, int whence)
+{
+    emu_file_t *file = NULL;
+    off_t new_pos = 0;
+
+    if (!emu_is_device(fd))
+    {
+        return real_lseek(fd, offset, whence);
+    }
+    pthread_mutex_lock(&emu_lock);
+    file = emu_file(fd);
+    if (NULL == file)
+    {
+        pthread_mutex_unlock(&emu_lock);
+        errno = EBADF;
+        return -1;
+    }
+    /* fixed_size_llseek over the bytes in the buffer */
+    switch (whence)
+    {
+        case SEEK_SET:
+        new_pos = offset;
+        break;
+
+        case SEEK_CUR:
+        new_pos = file->pos + offset;
+        break;
+
+        case SEEK_END:
+        new_pos = emu_buffer_size() + offset;
+        break;
+
+        default:
+        new_pos = -1;
+        break;
+    }
+    if ((new_pos < 0) || ((size_t)new_pos > emu_buffer_size()))
+    {
+        pthread_mutex_unlock(&emu_lock);
+        errno = EINVAL;
+        return -1;
+    }
+    file->pos = new_pos;
+    file->cursor_valid = false;
+    pthread_mutex_unlock(&emu_lock);
+    return new_pos;
+}
+
+off64_t lseek64(int fd, off64_t offset, int whence)
+{
+    return lseek(fd, offset, whence);
+}
+
+/**
+ * @brief AESDCHAR_IOCWRBATCH, adds every record of @param batch as one entry.  Caller must
+ * hold emu_lock.
+ */
+static int emu_write_batch(const struct aesd_write_batch *batch)
+{
+    const struct aesd_write_record *records = (const struct aesd_write_record *)(uintptr_t)batch->records;
+    char *copies[AESD_WRITE_BATCH_MAX];
+    struct aesd_buffer_entry entry;
+    uint64_t timestamp_ns = 0;
+    uint32_t index = 0;
+
+    if ((0 == batch->count) || (batch->count > AESD_WRITE_BATCH_MAX) || (0 != batch->flags))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    /* all records or none, like the driver */
+    for (index = 0; index < batch->count; index++)
+    {
+        copies[index] = (0 == records[index].len) ? NULL : malloc(records[index].len);
+        if (NULL == copies[index])
+        {
+            errno = (0 == records[index].len) ? EINVAL : ENOMEM;
+            while (index > 0)
+            {
+                free(copies[--index]);
+            }
+            return -1;
+        }
+        memcpy(copies[index], (const void *)(uintptr_t)records[index].buf, records[index].len);
+    }
+    /* one commit time for the whole batch, like the driver */
+    timestamp_ns = emu_commit_time();
+    for (index = 0; index < batch->count; index++)
+    {
+        entry.buffptr = copies[index];
+        entry.size = records[index].len;
+        entry.timestamp_ns = timestamp_ns;
+        free((char *)aesd_circular_buffer_add_entry(&emu_buffer, &entry));
+    }
+    return batch->count;
+}
+
+/**
+ * @brief AESDCHAR_IOCGENTRIES, describes the entries in @param table.  Caller must hold emu_lock.
+ */
+static int emu_get_entries(struct aesd_entry_table *table)
+{
+    struct aesd_entry_info *info = (struct aesd_entry_info *)(uintptr_t)table->entries;
+    struct aesd_buffer_entry *entry = NULL;
+    uint64_t offset = 0;
+    uint8_t count = aesd_circular_buffer_count(&emu_buffer);
+    uint8_t index = 0;
+
+    for (index = 0; index < count; index++)
+    {
+        entry = &emu_buffer.entry[(emu_buffer.out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        if (index < table->capacity)
+        {
+            info[index].seq = entry->seq;
+            info[index].offset = offset;
+            info[index].size = entry->size;
+            info[index].timestamp_ns = entry->timestamp_ns;
+        }
+        offset += entry->size;
+    }
+    table->count = count;
+    return 0;
+}
+
+/**
+ * @brief AESDCHAR_IOCSEEKTO, positions @param file at byte @param seek_data->write_cmd_offset of
+ * entry @param seek_data->write_cmd, counted from the oldest entry.  Caller must hold emu_lock.
+ */
+static int emu_seek_to(emu_file_t *file, const struct aesd_seekto *seek_data)
+{
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_start = 0;
+
+    if (seek_data->write_cmd < aesd_circular_buffer_count(&emu_buffer))
+    {
+        entry = aesd_circular_buffer_find_entry_for_seq(&emu_buffer,
+                        aesd_circular_buffer_first_seq(&emu_buffer) + seek_data->write_cmd, &entry_start);
+    }
+    if ((NULL == entry) || (seek_data->write_cmd_offset >= entry->size))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    file->pos = entry_start + seek_data->write_cmd_offset;
+    file->cursor_valid = false;
+    return 0;
+}
+
+/**
+ * @brief AESDCHAR_IOCSEEKTIME, positions @param file at the first entry committed at or after
+ * @param timestamp_ns, or at the end of the buffer.  Caller must hold emu_lock.
+ */
+static int emu_seek_time(emu_file_t *file, uint64_t timestamp_ns)
+{
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_start = 0;
+
+    entry = aesd_circular_buffer_find_entry_for_time(&emu_buffer, timestamp_ns, &entry_start);
+    if (NULL != entry)
+    {
+        file->seq = entry->seq;
+    }
+    else
+    {
+        file->seq = emu_buffer.next_seq;
+        entry_start = emu_buffer_size();
+    }
+    file->entry_offset = 0;
+    file->pos = entry_start;
+    file->cursor_pos = file->pos;
+    file->cursor_valid = true;
+    return 0;
+}
+
+/**
+ * @brief AESDCHAR_IOCGCURSOR, fills @param cursor with the read position of @param file.
+ * Caller must hold emu_lock.
+ */
+static int emu_get_cursor(emu_file_t *file, struct aesd_cursor *cursor)
+{
+    emu_sync_cursor(file);
+    cursor->seq = file->seq;
+    cursor->entry_offset = file->entry_offset;
+    cursor->missed = file->missed;
+    return 0;
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+    emu_file_t *file = NULL;
+    void *arg = NULL;
+    va_list args;
+    int status = 0;
+
+    va_start(args, request);
+    arg = va_arg(args, void *);
+    va_end(args);
+    if (!emu_is_device(fd))
+    {
+        return real_ioctl(fd, request, arg);
+    }
+
+    pthread_mutex_lock(&emu_lock);
+    file = emu_file(fd);
+    if (NULL == file)
+    {
+        pthread_mutex_unlock(&emu_lock);
+        errno = EBADF;
+        return -1;
+    }
+    switch (request)
+    {
+        case AESDCHAR_IOCSEEKTO:
+        status = emu_seek_to(file, arg);
+        break;
+
+        case AESDCHAR_IOCGCURSOR:
+        status = emu_get_cursor(file, arg);
+        break;
+
+        case AESDCHAR_IOCWRBATCH:
+        status = emu_write_batch(arg);
+        break;
+
+        case AESDCHAR_IOCGENTRIES:
+        status = emu_get_entries(arg);
+        break;
+
+        case AESDCHAR_IOCSEEKTIME:
+        status = emu_seek_time(file, ((const struct aesd_seektime *)arg)->timestamp_ns);
+        break;
+
+        case AESDCHAR_IOCSNAPSHOT:
+        case AESDCHAR_IOCRESTORE:
+        /* the emulated buffer lives and dies with the process, there is nothing to keep */
+        default:
+        errno = ENOTTY;
+        status = -1;
+        break;
+    }
+    pthread_mutex_unlock(&emu_lock);
+    return status;
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len,
+               unsigned int flags)
+{
+    /* callers fall back to read() like with a driver lacking splice_read */
+    if (emu_is_device(fd_in) || emu_is_device(fd_out))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    return real_splice(fd_in, off_in, fd_out, off_out, len, flags);
+}
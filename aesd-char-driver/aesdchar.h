@@ -10,7 +10,7 @@
 
 #include "aesd-circular-buffer.h"
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug
 
 #undef PDEBUG             /* undef it, just in case */
 #ifdef AESD_DEBUG
@@ -25,15 +25,96 @@
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/**
+ * Records up to this size, header included, are allocated from a dedicated kmem_cache
+ */
+#define AESD_RECORD_CACHE_SIZE 256
+/**
+ * Smallest working buffer allocated for an unterminated command
+ */
+#define AESD_PENDING_MIN_CAPACITY 256
+
+/**
+ * Storage for a committed entry, buffptr of the entry points at data.
+ * One reference is held by the ring, readers take another while copying.
+ */
+struct aesd_record
+{
+    struct rcu_head rcu;
+    refcount_t ref;
+    bool cached; /* allocated from the record cache */
+    char data[];
+};
+
+/**
+ * Working buffer accumulating a command until it is terminated by new line
+ */
+struct aesd_pending
+{
+    struct aesd_record *record; /* buffer, data holds capacity bytes */
+    size_t size; /* bytes written so far */
+    size_t capacity; /* bytes available in record->data */
+};
+
+/**
+ * Published copy of the circular buffer.  Writers replace it as a whole so
+ * readers can walk it under rcu_read_lock without the device lock.
+ */
+struct aesd_ring
+{
+    struct rcu_head rcu;
+    struct aesd_circular_buffer buffer;
+};
+
+/**
+ * Event counters of a device, one copy per CPU so the hot paths never share a cache line.
+ * Summed over all CPUs when the debugfs stats file is read.
+ */
+struct aesd_stats
+{
+    uint64_t reads; /* read calls returning data */
+    uint64_t read_bytes;
+    uint64_t writes; /* write calls and batches accepting data */
+    uint64_t write_bytes;
+    uint64_t evictions; /* entries dropped from the ring to make room */
+    uint64_t reallocs; /* krealloc calls on working buffers */
+    uint64_t restarts; /* -ERESTARTSYS returns */
+    uint64_t lock_waits; /* acquisitions of dev->lock */
+    uint64_t lock_wait_ns; /* time spent waiting for dev->lock */
+};
+
 struct aesd_dev
 {
     /**
      * TODO: Add structure(s) and locks needed to complete assignment requirements
      */
     struct cdev cdev;     /* Char device structure      */
-    struct aesd_circular_buffer buffer; /* circular buffer */
-    struct aesd_buffer_entry entry; /* working entry */
-    struct mutex lock; /* mutex for write operation */
+    struct aesd_ring __rcu *ring; /* circular buffer, replaced by writers */
+    struct aesd_pending pending; /* unterminated command left by a released file */
+    struct mutex entry_lock; /* protects pending */
+    struct mutex lock; /* serializes publishing to the ring */
+    struct aesd_mmap_header *mmap_header; /* page preceding arena, exported by mmap */
+    char *arena; /* byte ring holding entry data, NULL when each entry is a record */
+    size_t arena_size; /* bytes in arena */
+    size_t arena_tail; /* arena offset following the newest entry, protected by lock */
+    uint64_t arena_first_seq; /* entries below this sequence number may be overwritten */
+    struct aesd_stats __percpu *stats; /* event counters */
+    struct dentry *debugfs_dir; /* holds the stats file */
+};
+
+/**
+ * Per open file state, stored in filp->private_data
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev; /* device this file was opened on */
+    struct mutex lock; /* serializes use of the read cursor and working entry */
+    uint64_t seq; /* sequence number of the entry the read cursor is in */
+    size_t entry_offset; /* byte offset of the read cursor within that entry */
+    loff_t pos; /* f_pos value produced by the last read */
+    bool cursor_valid; /* false once the file is repositioned, seq is then derived from f_pos */
+    uint64_t missed; /* entries evicted before this reader could read them */
+    struct aesd_pending pending; /* working entry, committed once terminated by new line */
 };
 
 
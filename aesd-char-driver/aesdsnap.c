@@ -0,0 +1,181 @@
+/**
+ * @file aesdsnap.c
+ * @brief Saves the buffer of an aesdchar device to a file and restores it into a freshly
+ * loaded device, so aesdchar_unload and aesdchar_load keep the history across reloads.
+ *
+ * To compile: make aesdsnap
+ * Usage: aesdsnap save <device> <file>
+ *        aesdsnap restore <device> <file>
+ */
+
+/* Header files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#include "aesd_ioctl.h"
+
+/* Macro definitions */
+
+#define ARG_COUNT    (4)
+#define SUCCESS      (0)
+#define FAILURE      (-1)
+
+/**
+ * @brief Writes a snapshot of @param device to @param path, through a temporary file so an
+ * interrupted save never leaves a truncated snapshot behind.
+ */
+static int save_snapshot(const char *device, const char *path)
+{
+    int status = FAILURE;
+    int device_fd = -1;
+    FILE *file = NULL;
+    char *buf = NULL;
+    char tmp_path[4096];
+    struct aesd_snapshot snap;
+
+    device_fd = open(device, O_RDONLY);
+    if (device_fd < 0)
+    {
+        fprintf(stderr, "aesdsnap: open %s: %s\n", device, strerror(errno));
+        return FAILURE;
+    }
+    /* ask for the size first, retry if entries were written in between */
+    memset(&snap, 0, sizeof(snap));
+    while (ioctl(device_fd, AESDCHAR_IOCSNAPSHOT, &snap) < 0)
+    {
+        if (ENOSPC != errno)
+        {
+            fprintf(stderr, "aesdsnap: snapshot %s: %s\n", device, strerror(errno));
+            goto exit;
+        }
+        free(buf);
+        buf = malloc(snap.len);
+        if (NULL == buf)
+        {
+            fprintf(stderr, "aesdsnap: malloc %llu bytes failed\n", (unsigned long long)snap.len);
+            goto exit;
+        }
+        snap.buf = (uintptr_t)buf;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    file = fopen(tmp_path, "w");
+    if (NULL == file)
+    {
+        fprintf(stderr, "aesdsnap: open %s: %s\n", tmp_path, strerror(errno));
+        goto exit;
+    }
+    if ((fwrite(buf, 1, snap.len, file) != snap.len) || (0 != fclose(file)))
+    {
+        fprintf(stderr, "aesdsnap: write %s failed\n", tmp_path);
+        unlink(tmp_path);
+        goto exit;
+    }
+    if (0 != rename(tmp_path, path))
+    {
+        fprintf(stderr, "aesdsnap: rename %s: %s\n", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        goto exit;
+    }
+    status = SUCCESS;
+
+exit:
+    free(buf);
+    close(device_fd);
+    return status;
+}
+
+/**
+ * @brief Loads the snapshot in @param path into @param device
+ */
+static int restore_snapshot(const char *device, const char *path)
+{
+    int status = FAILURE;
+    int device_fd = -1;
+    int file_fd = -1;
+    char *buf = NULL;
+    struct stat file_stat;
+    struct aesd_snapshot snap;
+    ssize_t read_bytes = 0;
+    size_t total_bytes = 0;
+
+    file_fd = open(path, O_RDONLY);
+    if ((file_fd < 0) || (0 != fstat(file_fd, &file_stat)))
+    {
+        fprintf(stderr, "aesdsnap: open %s: %s\n", path, strerror(errno));
+        goto exit;
+    }
+    buf = malloc(file_stat.st_size);
+    if (NULL == buf)
+    {
+        fprintf(stderr, "aesdsnap: malloc %lld bytes failed\n", (long long)file_stat.st_size);
+        goto exit;
+    }
+    while (total_bytes < (size_t)file_stat.st_size)
+    {
+        read_bytes = read(file_fd, buf + total_bytes, file_stat.st_size - total_bytes);
+        if (read_bytes <= 0)
+        {
+            fprintf(stderr, "aesdsnap: read %s failed\n", path);
+            goto exit;
+        }
+        total_bytes += read_bytes;
+    }
+
+    device_fd = open(device, O_WRONLY);
+    if (device_fd < 0)
+    {
+        fprintf(stderr, "aesdsnap: open %s: %s\n", device, strerror(errno));
+        goto exit;
+    }
+    snap.buf = (uintptr_t)buf;
+    snap.len = total_bytes;
+    if (ioctl(device_fd, AESDCHAR_IOCRESTORE, &snap) < 0)
+    {
+        fprintf(stderr, "aesdsnap: restore %s: %s\n", device, strerror(errno));
+        goto exit;
+    }
+    status = SUCCESS;
+
+exit:
+    free(buf);
+    if (file_fd >= 0)
+    {
+        close(file_fd);
+    }
+    if (device_fd >= 0)
+    {
+        close(device_fd);
+    }
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    int status = FAILURE;
+
+    if (ARG_COUNT != argc)
+    {
+        fprintf(stderr, "Usage: %s save|restore <device> <file>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (0 == strcmp(argv[1], "save"))
+    {
+        status = save_snapshot(argv[2], argv[3]);
+    }
+    else if (0 == strcmp(argv[1], "restore"))
+    {
+        status = restore_snapshot(argv[2], argv[3]);
+    }
+    else
+    {
+        fprintf(stderr, "Usage: %s save|restore <device> <file>\n", argv[0]);
+    }
+    return (SUCCESS == status) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
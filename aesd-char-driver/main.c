@@ -19,218 +19,1469 @@
 #include <linux/fs.h> // file_operations
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/rcupdate.h>
+#include <linux/refcount.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/timekeeping.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "aesdchar.h"
 #include "aesd_ioctl.h"
 
+#define CREATE_TRACE_POINTS
+#include "aesd-trace.h"
+
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
+static unsigned int aesd_nr_devs = 1;
+module_param(aesd_nr_devs, uint, S_IRUGO);
+MODULE_PARM_DESC(aesd_nr_devs, "Number of aesdchar devices, each with its own buffer and locks");
+
+static unsigned long aesd_arena_size = 0;
+module_param(aesd_arena_size, ulong, S_IRUGO);
+MODULE_PARM_DESC(aesd_arena_size, "Bytes of contiguous entry storage per device, 0 allocates each entry separately");
+
 MODULE_AUTHOR("Chandana Challa");
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+struct aesd_dev *aesd_devices; /* aesd_nr_devs devices, minor numbers from aesd_minor */
+
+/* small committed records are allocated from this cache */
+static struct kmem_cache *aesd_record_cache;
+
+/* debugfs directory holding one directory per device */
+static struct dentry *aesd_debugfs_root;
+
+#define aesd_stat_add(dev, field, value) this_cpu_add((dev)->stats->field, (value))
+#define aesd_stat_inc(dev, field) this_cpu_inc((dev)->stats->field)
+
+/**
+ * @brief Acquires dev->lock, accounting the time spent waiting for it in @param wait_ns
+ * @return the ktime_get_ns() time the lock was acquired
+ */
+static u64 aesd_dev_lock(struct aesd_dev *dev, u64 *wait_ns)
+{
+    u64 start_ns = ktime_get_ns();
+    u64 locked_ns = 0;
+
+    mutex_lock(&dev->lock);
+    locked_ns = ktime_get_ns();
+    *wait_ns = locked_ns - start_ns;
+    aesd_stat_inc(dev, lock_waits);
+    aesd_stat_add(dev, lock_wait_ns, *wait_ns);
+    return locked_ns;
+}
+
+/**
+ * @brief Returns the record holding the entry data at @param buffptr
+ */
+static inline struct aesd_record *aesd_record_from_buffptr(const char *buffptr)
+{
+    return (struct aesd_record *)(buffptr - offsetof(struct aesd_record, data));
+}
+
+/**
+ * @brief Takes a reference on the record at @param buffptr so its data can be used outside
+ * the RCU read side critical section it was found in.
+ *
+ * @return the record, or NULL if it was evicted and is waiting to be freed.
+ */
+static struct aesd_record *aesd_record_get(const char *buffptr)
+{
+    struct aesd_record *record = aesd_record_from_buffptr(buffptr);
+
+    if (!refcount_inc_not_zero(&record->ref))
+    {
+        return NULL;
+    }
+    return record;
+}
+
+/**
+ * @brief Allocates a record for @param size bytes of entry data holding one reference.
+ * Records small enough come from aesd_record_cache.
+ */
+static struct aesd_record *aesd_record_alloc(size_t size)
+{
+    struct aesd_record *record = NULL;
+
+    if (struct_size(record, data, size) <= AESD_RECORD_CACHE_SIZE)
+    {
+        record = kmem_cache_alloc(aesd_record_cache, GFP_KERNEL);
+        if (NULL != record)
+        {
+            record->cached = true;
+        }
+    }
+    else
+    {
+        record = kmalloc(struct_size(record, data, size), GFP_KERNEL);
+        if (NULL != record)
+        {
+            record->cached = false;
+        }
+    }
+    if (NULL != record)
+    {
+        refcount_set(&record->ref, 1);
+    }
+    return record;
+}
+
+static void aesd_record_free_rcu(struct rcu_head *head)
+{
+    struct aesd_record *record = container_of(head, struct aesd_record, rcu);
+
+    if (record->cached)
+    {
+        kmem_cache_free(aesd_record_cache, record);
+    }
+    else
+    {
+        kfree(record);
+    }
+}
+
+/**
+ * @brief Drops a reference on @param record, freeing it after a grace period once the
+ * last reference is gone.
+ */
+static void aesd_record_put(struct aesd_record *record)
+{
+    if (refcount_dec_and_test(&record->ref))
+    {
+        /* kfree_rcu cannot return objects to aesd_record_cache on every kernel */
+        call_rcu(&record->rcu, aesd_record_free_rcu);
+    }
+}
+
+/**
+ * @brief Makes room for @param extra more bytes in @param pending.
+ *
+ * The buffer at least doubles each time it grows, so a command arriving in many small
+ * writes is copied a constant number of times per byte instead of once per write.
+ *
+ * @return 0 on success, -ENOMEM if the buffer could not grow.
+ */
+static int aesd_pending_reserve(struct aesd_dev *dev, struct aesd_pending *pending, size_t extra)
+{
+    struct aesd_record *record = NULL;
+    size_t capacity = pending->capacity;
+
+    if ((pending->size + extra) <= capacity)
+    {
+        return 0;
+    }
+    capacity = max_t(size_t, capacity * 2, pending->size + extra);
+    capacity = max_t(size_t, capacity, AESD_PENDING_MIN_CAPACITY);
+    aesd_stat_inc(dev, reallocs);
+    record = krealloc(pending->record, struct_size(record, data, capacity), GFP_KERNEL);
+    if (NULL == record)
+    {
+        return -ENOMEM;
+    }
+    pending->record = record;
+    pending->capacity = capacity;
+    return 0;
+}
+
+/**
+ * @brief Frees the working buffer of @param pending along with any data in it
+ */
+static void aesd_pending_free(struct aesd_pending *pending)
+{
+    kfree(pending->record);
+    pending->record = NULL;
+    pending->size = 0;
+    pending->capacity = 0;
+}
+
+/**
+ * @brief Turns the data in @param pending into a record sized exactly for it and describes
+ * it in @param entry.
+ *
+ * Small commands are copied into a record from aesd_record_cache and the working buffer is
+ * kept for the next command.  Larger ones take over the working buffer, trimmed to size.
+ *
+ * @return the record holding one reference, or NULL if no memory was available, in which
+ * case @param pending is unchanged.
+ */
+static struct aesd_record *aesd_pending_commit(struct aesd_dev *dev, struct aesd_pending *pending,
+                                               struct aesd_buffer_entry *entry)
+{
+    struct aesd_record *record = NULL;
+
+    if (struct_size(record, data, pending->size) <= AESD_RECORD_CACHE_SIZE)
+    {
+        record = aesd_record_alloc(pending->size);
+        if (NULL == record)
+        {
+            return NULL;
+        }
+        memcpy(record->data, pending->record->data, pending->size);
+    }
+    else
+    {
+        aesd_stat_inc(dev, reallocs);
+        record = krealloc(pending->record, struct_size(record, data, pending->size), GFP_KERNEL);
+        if (NULL == record)
+        {
+            /* could not trim, commit the buffer as it is */
+            record = pending->record;
+        }
+        record->cached = false;
+        refcount_set(&record->ref, 1);
+        pending->record = NULL;
+        pending->capacity = 0;
+    }
+    entry->buffptr = record->data;
+    entry->size = pending->size;
+    pending->size = 0;
+    return record;
+}
+
+/**
+ * @brief Hands the unterminated command of a file being released to the device, where the
+ * next file opened for writing picks it up.  This keeps a command split across several
+ * open/write/close cycles working, while files that are open at the same time never mix
+ * their partial commands.
+ */
+static void aesd_release_pending(struct aesd_dev *dev, struct aesd_file *fdata)
+{
+    mutex_lock(&dev->entry_lock);
+    if (0 == dev->pending.size)
+    {
+        aesd_pending_free(&dev->pending);
+        dev->pending = fdata->pending;
+    }
+    else
+    {
+        if (0 == aesd_pending_reserve(dev, &dev->pending, fdata->pending.size))
+        {
+            memcpy(dev->pending.record->data + dev->pending.size, fdata->pending.record->data,
+                   fdata->pending.size);
+            dev->pending.size += fdata->pending.size;
+        }
+        else
+        {
+            PDEBUG("ERROR: krealloc allocating memory, dropping partial command");
+        }
+        aesd_pending_free(&fdata->pending);
+    }
+    mutex_unlock(&dev->entry_lock);
+    memset(&fdata->pending, 0, sizeof(struct aesd_pending));
+}
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
     struct aesd_dev *dev = NULL;
+    struct aesd_file *fdata = NULL;
     PDEBUG("open");
 
     dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev;
+    fdata = kzalloc(sizeof(struct aesd_file), GFP_KERNEL);
+    if (NULL == fdata)
+    {
+        PDEBUG("ERROR: kzalloc allocating file data");
+        return -ENOMEM;
+    }
+    fdata->dev = dev;
+    mutex_init(&fdata->lock);
+
+    /* start reading at the oldest entry currently in the buffer */
+    rcu_read_lock();
+    fdata->seq = aesd_circular_buffer_first_seq(&rcu_dereference(dev->ring)->buffer);
+    rcu_read_unlock();
+    fdata->cursor_valid = true;
+
+    /* continue a command left unterminated by a file that was closed */
+    if (filp->f_mode & FMODE_WRITE)
+    {
+        mutex_lock(&dev->entry_lock);
+        fdata->pending = dev->pending;
+        memset(&dev->pending, 0, sizeof(struct aesd_pending));
+        mutex_unlock(&dev->entry_lock);
+    }
+
+    filp->private_data = fdata;
     return 0;
 }
 
 int aesd_release(struct inode *inode, struct file *filp)
 {
+    struct aesd_file *fdata = filp->private_data;
     PDEBUG("release");
+    if (0 != fdata->pending.size)
+    {
+        aesd_release_pending(fdata->dev, fdata);
+    }
+    aesd_pending_free(&fdata->pending);
+    mutex_destroy(&fdata->lock);
+    kfree(fdata);
     filp->private_data = NULL;
     return 0;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+/**
+ * @brief Returns the total number of bytes stored in the live entries of @param buffer.
+ * Slots emptied by aesd_circular_buffer_remove_entry keep their old contents, so only the
+ * entries from out_offs on are counted.  Any necessary locking must be performed by caller.
+ */
+static loff_t aesd_buffer_size(struct aesd_circular_buffer *buffer)
 {
-    ssize_t retval = 0;
+    uint8_t index = 0;
+    uint8_t count = aesd_circular_buffer_count(buffer);
+    loff_t total_size = 0;
+
+    for (index = 0; index < count; index++)
+    {
+        total_size += buffer->entry[(buffer->out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED].size;
+    }
+    return total_size;
+}
+
+/**
+ * @brief Brings the sequence cursor of @param fdata in line with @param f_pos.
+ *
+ * While f_pos is the value produced by the previous read the cursor is authoritative, so a
+ * reader resumes at the same entry even if older entries were evicted in between.  If the file
+ * was repositioned, f_pos is taken as a byte offset into the current buffer contents.
+ * Entries evicted before the cursor reached them are skipped and counted in fdata->missed,
+ * including arena entries a writer is about to overwrite but has not yet dropped from the ring.
+ * Caller must hold fdata->lock and an RCU read lock protecting @param buffer.
+ */
+static void aesd_sync_cursor(struct aesd_file *fdata, struct aesd_circular_buffer *buffer,
+                             loff_t f_pos)
+{
+    struct aesd_buffer_entry *entry = NULL;
     size_t entry_offset = 0;
+    uint64_t first_seq = 0;
+
+    if ((!fdata->cursor_valid) || (f_pos != fdata->pos))
+    {
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(buffer, f_pos, &entry_offset);
+        if (NULL != entry)
+        {
+            fdata->seq = entry->seq;
+            fdata->entry_offset = entry_offset;
+        }
+        else
+        {
+            /* past the end, wait for the next entry */
+            fdata->seq = buffer->next_seq;
+            fdata->entry_offset = 0;
+        }
+        fdata->cursor_valid = true;
+    }
+
+    first_seq = max_t(uint64_t, aesd_circular_buffer_first_seq(buffer),
+                      READ_ONCE(fdata->dev->arena_first_seq));
+    if (fdata->seq < first_seq)
+    {
+        fdata->missed += (first_seq - fdata->seq);
+        fdata->seq = first_seq;
+        fdata->entry_offset = 0;
+    }
+}
+
+/**
+ * @brief Reads from the entry at the cursor of the file into @param to.
+ *
+ * Implemented as read_iter so that read(), readv() and splice() from the device all use it,
+ * the latter through the generic splice helpers.
+ */
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    ssize_t retval = 0;
+    size_t entry_start = 0;
+    size_t entry_size = 0;
+    uint64_t entry_seq = 0;
+    const char *entry_data = NULL;
     struct aesd_buffer_entry *entry = NULL;
+    struct aesd_record *record = NULL;
+    struct aesd_circular_buffer *buffer = NULL;
     ssize_t read_bytes = 0;
+    struct file *filp = NULL;
+    loff_t *f_pos = NULL;
+    struct aesd_file *fdata = NULL;
+    struct aesd_dev *dev = NULL;
+    u64 locked_ns = 0;
+    
+    if ( (NULL == iocb) || (NULL == to))
+    {
+        PDEBUG("ERROR: aesd_read_iter invalid arguments");
+        return -EINVAL;
+    }
+    filp = iocb->ki_filp;
+    f_pos = &iocb->ki_pos;
+    PDEBUG("read %zu bytes with offset %lld",iov_iter_count(to),*f_pos);
+
+    fdata = filp->private_data;
+    dev = fdata->dev;
+    /* only the file's own cursor is locked, the ring is read under RCU */
+    if (0 != mutex_lock_interruptible(&fdata->lock))
+    {
+        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
+        aesd_stat_inc(dev, restarts);
+        return -ERESTARTSYS;
+    }
+    if (trace_aesd_read_enabled())
+    {
+        locked_ns = ktime_get_ns();
+    }
+
+retry:
+    rcu_read_lock();
+    buffer = &rcu_dereference(dev->ring)->buffer;
+    aesd_sync_cursor(fdata, buffer, *f_pos);
+    entry = aesd_circular_buffer_find_entry_for_seq(buffer, fdata->seq, &entry_start);
+    if (NULL == entry)
+    {
+        /* cursor is at the end of the buffer */
+        *f_pos = aesd_buffer_size(buffer);
+        rcu_read_unlock();
+        goto exit;
+    }
+    entry_size = entry->size;
+    entry_seq = entry->seq;
+    entry_data = entry->buffptr;
+    if (NULL == dev->arena)
+    {
+        /* a failed get means a writer evicted the entry, retry against the new ring */
+        record = aesd_record_get(entry->buffptr);
+        if (NULL == record)
+        {
+            rcu_read_unlock();
+            goto retry;
+        }
+    }
+    rcu_read_unlock();
+
+    /* copy_to_iter may fault, it runs with only a reference on the record */
+    read_bytes = (entry_size - fdata->entry_offset);
+    if (read_bytes > iov_iter_count(to))
+    {
+        read_bytes = iov_iter_count(to);
+    }
+    /* copy_to_iter returns the number of bytes copied */
+    retval = copy_to_iter((entry_data + fdata->entry_offset), read_bytes, to);
+    if (NULL != record)
+    {
+        aesd_record_put(record);
+    }
+    else
+    {
+        /* arena bytes are only overwritten after arena_first_seq moved past their entry */
+        smp_rmb();
+        if (READ_ONCE(dev->arena_first_seq) > entry_seq)
+        {
+            iov_iter_revert(to, retval);
+            retval = 0;
+            goto retry;
+        }
+    }
+    if (retval != read_bytes)
+    {
+        PDEBUG("ERROR:copy_to_iter copied %zd of %zd bytes", retval, read_bytes);
+        if (0 == retval)
+        {
+            retval = -EFAULT;
+            goto exit;
+        }
+    }
+    if (trace_aesd_read_enabled())
+    {
+        trace_aesd_read(MINOR(dev->cdev.dev), entry_seq, fdata->entry_offset, retval,
+                        ktime_get_ns() - locked_ns);
+    }
+    fdata->entry_offset += retval;
+    if (fdata->entry_offset >= entry_size)
+    {
+        fdata->seq++;
+        fdata->entry_offset = 0;
+        entry_start += entry_size;
+    }
+    *f_pos = entry_start + fdata->entry_offset;
+    aesd_stat_inc(dev, reads);
+    aesd_stat_add(dev, read_bytes, retval);
+
+exit:
+    fdata->pos = *f_pos;
+    mutex_unlock(&fdata->lock);
+    return retval;
+}
+
+/**
+ * @brief Returns the commit time for entries added to @param buffer now.  The wall clock can
+ * be set backwards, so the time never goes below that of the newest entry, keeping the
+ * timestamps ordered for aesd_circular_buffer_find_entry_for_time.
+ */
+static uint64_t aesd_commit_time(const struct aesd_circular_buffer *buffer)
+{
+    uint64_t timestamp_ns = ktime_get_real_ns();
+    const struct aesd_buffer_entry *newest = NULL;
+
+    if (0 != aesd_circular_buffer_count(buffer))
+    {
+        newest = &buffer->entry[(buffer->in_offs + AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - 1) %
+                                AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        timestamp_ns = max_t(uint64_t, timestamp_ns, newest->timestamp_ns);
+    }
+    return timestamp_ns;
+}
+
+/**
+ * @brief Emits the tracepoints of a publish replacing @param old_buffer with @param new_buffer
+ * after adding the @param count entries at @param entries, whose sizes describe evicted
+ * entries that never reached the old buffer.  Caller must hold dev->lock.
+ */
+static void aesd_trace_publish(struct aesd_dev *dev, struct aesd_circular_buffer *old_buffer,
+                               const struct aesd_circular_buffer *new_buffer,
+                               const struct aesd_buffer_entry *entries, size_t count,
+                               u64 wait_ns, u64 held_ns)
+{
+    struct aesd_buffer_entry *entry = NULL;
+    uint64_t seq = 0;
+    size_t bytes = 0;
+    size_t index = 0;
+
+    if (trace_aesd_evict_enabled())
+    {
+        for (seq = aesd_circular_buffer_first_seq(old_buffer);
+             seq < aesd_circular_buffer_first_seq(new_buffer); seq++)
+        {
+            entry = aesd_circular_buffer_find_entry_for_seq(old_buffer, seq, NULL);
+            trace_aesd_evict(MINOR(dev->cdev.dev), seq,
+                             (NULL != entry) ? entry->size : entries[seq - old_buffer->next_seq].size);
+        }
+    }
+    if (trace_aesd_commit_enabled())
+    {
+        for (index = 0; index < count; index++)
+        {
+            bytes += entries[index].size;
+        }
+        trace_aesd_commit(MINOR(dev->cdev.dev), new_buffer->next_seq - count, count, bytes,
+                          wait_ns, held_ns);
+    }
+}
+
+/**
+ * @brief Adds the @param count entries at @param entries to the ring of @param dev, in order,
+ * using the preallocated @param new_ring.
+ *
+ * Only the ring copy and the pointer swap run under dev->lock, so the hold time does not
+ * depend on the size of the entries.  The references on the entry records pass to the ring.
+ * On return the buffptr of each member of @param entries is the entry it evicted, or NULL.
+ */
+static void aesd_publish_entries(struct aesd_dev *dev, struct aesd_ring *new_ring,
+                                 struct aesd_buffer_entry *entries, size_t count)
+{
+    size_t index = 0;
+    struct aesd_ring *old_ring = NULL;
+    uint64_t timestamp_ns = 0;
+    u64 wait_ns = 0;
+    u64 locked_ns = 0;
+
+    locked_ns = aesd_dev_lock(dev, &wait_ns);
+    old_ring = rcu_dereference_protected(dev->ring, lockdep_is_held(&dev->lock));
+    memcpy(&new_ring->buffer, &old_ring->buffer, sizeof(struct aesd_circular_buffer));
+    /* stamped under the lock so commit times follow sequence numbers */
+    timestamp_ns = aesd_commit_time(&new_ring->buffer);
+    for (index = 0; index < count; index++)
+    {
+        entries[index].timestamp_ns = timestamp_ns;
+        entries[index].buffptr = aesd_circular_buffer_add_entry(&new_ring->buffer, &entries[index]);
+    }
+    aesd_stat_add(dev, evictions, aesd_circular_buffer_first_seq(&new_ring->buffer) -
+                                  aesd_circular_buffer_first_seq(&old_ring->buffer));
+    rcu_assign_pointer(dev->ring, new_ring);
+    aesd_trace_publish(dev, &old_ring->buffer, &new_ring->buffer, entries, count,
+                       wait_ns, ktime_get_ns() - locked_ns);
+    mutex_unlock(&dev->lock);
+
+    kfree_rcu(old_ring, rcu);
+    /* drop the ring reference on the overwritten entries */
+    for (index = 0; index < count; index++)
+    {
+        if (NULL != entries[index].buffptr)
+        {
+            aesd_record_put(aesd_record_from_buffptr(entries[index].buffptr));
+        }
+    }
+}
+
+/**
+ * @brief Returns the arena offset where @param size bytes can be stored after the newest
+ * entry of @param buffer, removing the oldest entries until the space is free.
+ *
+ * Entries never wrap around the end of the arena, so live data is at most two contiguous
+ * spans.  Caller must hold dev->lock and @param buffer must not be published yet.
+ */
+static size_t aesd_arena_place(struct aesd_dev *dev, struct aesd_circular_buffer *buffer,
+                               size_t size)
+{
+    size_t head = 0;
+
+    while (0 != aesd_circular_buffer_count(buffer))
+    {
+        head = buffer->entry[buffer->out_offs].buffptr - dev->arena;
+        if (head < dev->arena_tail)
+        {
+            /* free space is after the tail and before the head */
+            if ((dev->arena_size - dev->arena_tail) >= size)
+            {
+                return dev->arena_tail;
+            }
+            if (head >= size)
+            {
+                return 0;
+            }
+        }
+        else if ((head - dev->arena_tail) >= size)
+        {
+            return dev->arena_tail;
+        }
+        aesd_circular_buffer_remove_entry(buffer);
+    }
+    return 0;
+}
+
+/**
+ * @brief Mirrors @param buffer into the header page user space sees through mmap.
+ *
+ * The generation count is odd while the header changes, mapped readers retry when it is odd
+ * or differs before and after their read.  Caller must hold dev->lock.
+ */
+static void aesd_arena_update_header(struct aesd_dev *dev, const struct aesd_circular_buffer *buffer)
+{
+    struct aesd_mmap_header *header = dev->mmap_header;
+    uint8_t count = aesd_circular_buffer_count(buffer);
+    uint8_t index = 0;
+    const struct aesd_buffer_entry *entry = NULL;
+
+    WRITE_ONCE(header->generation, header->generation + 1);
+    smp_wmb();
+    header->entry_count = count;
+    header->first_seq = aesd_circular_buffer_first_seq(buffer);
+    header->next_seq = buffer->next_seq;
+    header->head = 0;
+    header->tail = dev->arena_tail;
+    for (index = 0; index < count; index++)
+    {
+        entry = &buffer->entry[(buffer->out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        header->entry[index].seq = entry->seq;
+        header->entry[index].offset = entry->buffptr - dev->arena;
+        header->entry[index].size = entry->size;
+    }
+    if (0 != count)
+    {
+        header->head = header->entry[0].offset;
+    }
+    smp_wmb();
+    WRITE_ONCE(header->generation, header->generation + 1);
+}
+
+/**
+ * @brief Copies the @param count entries at @param entries into the arena of @param dev and
+ * adds them to the ring, in order, using the preallocated @param new_ring.  The entries point
+ * at kernel memory that stays owned by the caller.
+ *
+ * Eviction only advances the head, nothing is freed.  Readers copy arena bytes without a
+ * lock, so arena_first_seq is moved past the evicted entries before their bytes change.
+ */
+static void aesd_publish_arena_entries(struct aesd_dev *dev, struct aesd_ring *new_ring,
+                                       const struct aesd_buffer_entry *entries, size_t count)
+{
+    struct aesd_ring *old_ring = NULL;
+    struct aesd_buffer_entry entry;
+    size_t offset = 0;
+    size_t index = 0;
+    uint64_t timestamp_ns = 0;
+    u64 wait_ns = 0;
+    u64 locked_ns = 0;
+
+    locked_ns = aesd_dev_lock(dev, &wait_ns);
+    old_ring = rcu_dereference_protected(dev->ring, lockdep_is_held(&dev->lock));
+    memcpy(&new_ring->buffer, &old_ring->buffer, sizeof(struct aesd_circular_buffer));
+    /* stamped under the lock so commit times follow sequence numbers */
+    timestamp_ns = aesd_commit_time(&new_ring->buffer);
+    for (index = 0; index < count; index++)
+    {
+        if (new_ring->buffer.full)
+        {
+            /* evict here rather than in add_entry, before any bytes are overwritten */
+            aesd_circular_buffer_remove_entry(&new_ring->buffer);
+        }
+        offset = aesd_arena_place(dev, &new_ring->buffer, entries[index].size);
+        WRITE_ONCE(dev->arena_first_seq, aesd_circular_buffer_first_seq(&new_ring->buffer));
+        /* mapped readers learn about the eviction before the bytes change as well */
+        aesd_arena_update_header(dev, &new_ring->buffer);
+        smp_wmb();
+        memcpy(dev->arena + offset, entries[index].buffptr, entries[index].size);
+        dev->arena_tail = offset + entries[index].size;
+
+        entry.buffptr = dev->arena + offset;
+        entry.size = entries[index].size;
+        entry.timestamp_ns = timestamp_ns;
+        aesd_circular_buffer_add_entry(&new_ring->buffer, &entry);
+    }
+    aesd_arena_update_header(dev, &new_ring->buffer);
+    aesd_stat_add(dev, evictions, aesd_circular_buffer_first_seq(&new_ring->buffer) -
+                                  aesd_circular_buffer_first_seq(&old_ring->buffer));
+    rcu_assign_pointer(dev->ring, new_ring);
+    aesd_trace_publish(dev, &old_ring->buffer, &new_ring->buffer, entries, count,
+                       wait_ns, ktime_get_ns() - locked_ns);
+    mutex_unlock(&dev->lock);
+
+    kfree_rcu(old_ring, rcu);
+}
+
+/**
+ * @brief Adds the new line terminated command in @param pending to the buffer of @param dev.
+ *
+ * @return 0 on success with @param pending emptied, -EFBIG if the command can never fit the
+ * arena, in which case it is dropped, or -ENOMEM with @param pending unchanged.
+ */
+static int aesd_commit_pending(struct aesd_dev *dev, struct aesd_pending *pending)
+{
+    struct aesd_record *record = NULL;
+    struct aesd_ring *new_ring = NULL;
+    struct aesd_buffer_entry commit_entry;
+
+    if ((NULL != dev->arena) && (pending->size > dev->arena_size))
+    {
+        PDEBUG("ERROR: command of %zu bytes does not fit the arena", pending->size);
+        pending->size = 0;
+        return -EFBIG;
+    }
+    new_ring = kmalloc(sizeof(struct aesd_ring), GFP_KERNEL);
+    if ((NULL != new_ring) && (NULL == dev->arena))
+    {
+        record = aesd_pending_commit(dev, pending, &commit_entry);
+    }
+    if ((NULL == new_ring) || ((NULL == dev->arena) && (NULL == record)))
+    {
+        PDEBUG("ERROR: allocating memory to commit");
+        kfree(new_ring);
+        return -ENOMEM;
+    }
+    if (NULL != dev->arena)
+    {
+        /* the working buffer stays with the file for the next command */
+        commit_entry.buffptr = pending->record->data;
+        commit_entry.size = pending->size;
+        aesd_publish_arena_entries(dev, new_ring, &commit_entry, 1);
+        pending->size = 0;
+    }
+    else
+    {
+        aesd_publish_entries(dev, new_ring, &commit_entry, 1);
+    }
+    return 0;
+}
+
+/**
+ * @brief Appends the data of @param from to the working entry of the file.
+ *
+ * Each iovec member is handled like a separate write(), so a writev of several new line
+ * terminated members adds one entry per member, while a plain write adds at most one entry
+ * as before.
+ */
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    ssize_t retval = 0;
+    ssize_t written = 0;
+    size_t count = 0;
+    size_t copied = 0;
+    struct aesd_pending *pending = NULL;
+    struct aesd_file *fdata = NULL;
+    struct aesd_dev *dev = NULL;
+
+    if ( (NULL == iocb) || (NULL == from))
+    {
+        PDEBUG("ERROR: aesd_write_iter invalid arguments");
+        return -EINVAL;
+    }
+
+    PDEBUG("write %zu bytes with offset %lld",iov_iter_count(from),iocb->ki_pos);
+
+    fdata = iocb->ki_filp->private_data;
+    dev = fdata->dev;
+    pending = &fdata->pending;
+    if (0 == iov_iter_count(from))
+    {
+        return 0;
+    }
+
+    /* the working entry belongs to this file, dev->lock is only taken to publish */
+    if (0 != mutex_lock_interruptible(&fdata->lock))
+    {
+        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
+        aesd_stat_inc(dev, restarts);
+        return -ERESTARTSYS;
+    }
+    while (0 != iov_iter_count(from))
+    {
+        count = iov_iter_single_seg_count(from);
+        if (0 == count)
+        {
+            /* advancing by nothing steps over empty iovec members */
+            iov_iter_advance(from, 0);
+            continue;
+        }
+        if (0 != aesd_pending_reserve(dev, pending, count))
+        {
+            PDEBUG("ERROR: krealloc allocating memory");
+            retval = -ENOMEM;
+            goto exit;
+        }
+
+        /* copy_from_iter returns the number of bytes copied */
+        copied = copy_from_iter((pending->record->data + pending->size), count, from);
+        if (0 == copied)
+        {
+            PDEBUG("ERROR:copy_from_iter copied 0 of %zu bytes", count);
+            retval = -EFAULT;
+            goto exit;
+        }
+        pending->size += copied;
+
+        /* add to circular buffer if command is terminated by new line */
+        if (pending->record->data[pending->size-1] == '\n')
+        {
+            retval = aesd_commit_pending(dev, pending);
+            if (-ENOMEM == retval)
+            {
+                pending->size -= copied;
+            }
+            if (0 != retval)
+            {
+                goto exit;
+            }
+        }
+        written += copied;
+        if (copied != count)
+        {
+            PDEBUG("ERROR:copy_from_iter copied %zu of %zu bytes", copied, count);
+            break;
+        }
+    }
+
+exit:
+    mutex_unlock(&fdata->lock);
+    if (0 != written)
+    {
+        aesd_stat_inc(dev, writes);
+        aesd_stat_add(dev, write_bytes, written);
+    }
+    /* members added before a failure are reported as written */
+    return (0 != written) ? written : retval;
+}
+
+loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
+{
+    struct aesd_file *fdata = NULL;
+    struct aesd_dev *dev = NULL;
+    loff_t file_offset = 0;
+    loff_t total_size = 0;
+
+    if (NULL == filp)
+    {
+        PDEBUG("ERROR: aesd_llseek invalid arguments");
+        return -EINVAL;
+    }
+
+    fdata = filp->private_data;
+    dev = fdata->dev;
+
+    rcu_read_lock();
+    total_size = aesd_buffer_size(&rcu_dereference(dev->ring)->buffer);
+    rcu_read_unlock();
+
+    if (0 != mutex_lock_interruptible(&fdata->lock))
+    {
+        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
+        aesd_stat_inc(dev, restarts);
+        return -ERESTARTSYS;
+    }
+    file_offset = fixed_size_llseek(filp, offset, whence, total_size);
+    if (file_offset >= 0)
+    {
+        fdata->cursor_valid = false;
+    }
+    mutex_unlock(&fdata->lock);
+    trace_aesd_llseek(MINOR(dev->cdev.dev), offset, whence, file_offset);
+    
+    return file_offset;
+
+}
+
+static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd,
+                                    unsigned int write_cmd_offset)
+{
+    struct aesd_file *fdata = NULL;
+    struct aesd_dev *dev = NULL;
+    long return_value = 0;
+    struct aesd_circular_buffer *buffer = NULL;
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_start = 0;
+
+    if (NULL == filp)
+    {
+        PDEBUG("ERROR: aesd_adjust_file_offset invalid arguments");
+        return -EINVAL;
+    }
+
+    fdata = filp->private_data;
+    dev = fdata->dev;
+
+    if (0 != mutex_lock_interruptible(&fdata->lock))
+    {
+        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
+        aesd_stat_inc(dev, restarts);
+        return -ERESTARTSYS;
+    }
+    rcu_read_lock();
+    buffer = &rcu_dereference(dev->ring)->buffer;
+    /* write_cmd counts from the oldest entry in the buffer */
+    entry = NULL;
+    if (write_cmd < aesd_circular_buffer_count(buffer))
+    {
+        entry = aesd_circular_buffer_find_entry_for_seq(buffer,
+                        aesd_circular_buffer_first_seq(buffer) + write_cmd, &entry_start);
+    }
+    if ( (NULL == entry) ||
+         (write_cmd_offset >= entry->size) )
+    {
+        return_value = -EINVAL;
+        goto exit;
+    }
+    
+    filp->f_pos = entry_start + write_cmd_offset;
+    fdata->cursor_valid = false;
+
+exit:
+    rcu_read_unlock();
+    trace_aesd_seekto(MINOR(dev->cdev.dev), write_cmd, write_cmd_offset, filp->f_pos, return_value);
+    mutex_unlock(&fdata->lock);
+    return return_value;
+}
+
+/**
+ * @brief Positions @param filp at the first entry committed at or after @param timestamp_ns,
+ * or at the end of the buffer if every entry is older.
+ *
+ * The cursor is set to the sequence number of that entry, so the next read starts there even
+ * if older entries are evicted meanwhile.
+ */
+static long aesd_seek_time(struct file *filp, uint64_t timestamp_ns)
+{
+    struct aesd_file *fdata = NULL;
+    struct aesd_dev *dev = NULL;
+    struct aesd_circular_buffer *buffer = NULL;
+    struct aesd_buffer_entry *entry = NULL;
+    size_t entry_start = 0;
+
+    if (NULL == filp)
+    {
+        PDEBUG("ERROR: aesd_seek_time invalid arguments");
+        return -EINVAL;
+    }
+
+    fdata = filp->private_data;
+    dev = fdata->dev;
+
+    if (0 != mutex_lock_interruptible(&fdata->lock))
+    {
+        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
+        aesd_stat_inc(dev, restarts);
+        return -ERESTARTSYS;
+    }
+    rcu_read_lock();
+    buffer = &rcu_dereference(dev->ring)->buffer;
+    entry = aesd_circular_buffer_find_entry_for_time(buffer, timestamp_ns, &entry_start);
+    if (NULL != entry)
+    {
+        fdata->seq = entry->seq;
+    }
+    else
+    {
+        fdata->seq = buffer->next_seq;
+        entry_start = aesd_buffer_size(buffer);
+    }
+    rcu_read_unlock();
+    fdata->entry_offset = 0;
+    filp->f_pos = entry_start;
+    fdata->pos = filp->f_pos;
+    fdata->cursor_valid = true;
+    mutex_unlock(&fdata->lock);
+    return 0;
+}
+
+/**
+ * @brief Fills @param cursor with the read position of @param filp
+ */
+static long aesd_get_cursor(struct file *filp, struct aesd_cursor *cursor)
+{
+    struct aesd_file *fdata = NULL;
+    struct aesd_dev *dev = NULL;
+
+    if ((NULL == filp) || (NULL == cursor))
+    {
+        PDEBUG("ERROR: aesd_get_cursor invalid arguments");
+        return -EINVAL;
+    }
+
+    fdata = filp->private_data;
+    dev = fdata->dev;
+
+    if (0 != mutex_lock_interruptible(&fdata->lock))
+    {
+        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
+        aesd_stat_inc(dev, restarts);
+        return -ERESTARTSYS;
+    }
+    rcu_read_lock();
+    aesd_sync_cursor(fdata, &rcu_dereference(dev->ring)->buffer, filp->f_pos);
+    rcu_read_unlock();
+    cursor->seq = fdata->seq;
+    cursor->entry_offset = fdata->entry_offset;
+    cursor->missed = fdata->missed;
+    mutex_unlock(&fdata->lock);
+    return 0;
+}
+
+/**
+ * @brief Adds the commands described by @param batch to the buffer of the device under a
+ * single acquisition of dev->lock.  All commands are copied in before anything is published,
+ * so either every command is added or none is.
+ *
+ * @return the number of commands added, or a negative error code.
+ */
+static long aesd_write_batch(struct file *filp, const struct aesd_write_batch *batch)
+{
+    struct aesd_file *fdata = NULL;
     struct aesd_dev *dev = NULL;
-    
-    if ( (NULL == filp) || (NULL == buf))
+    struct aesd_write_record *records = NULL;
+    struct aesd_buffer_entry *entries = NULL;
+    struct aesd_record *record = NULL;
+    struct aesd_ring *new_ring = NULL;
+    char *staging = NULL;
+    size_t total_size = 0;
+    uint32_t index = 0;
+    long return_value = 0;
+
+    if ((NULL == filp) || (NULL == batch))
     {
-        PDEBUG("ERROR: aesd_read invalid arguments");
+        PDEBUG("ERROR: aesd_write_batch invalid arguments");
         return -EINVAL;
     }
-    PDEBUG("read %zu bytes with offset %lld",count,*f_pos);
+    if ((0 == batch->count) || (batch->count > AESD_WRITE_BATCH_MAX) || (0 != batch->flags))
+    {
+        return -EINVAL;
+    }
+
+    fdata = filp->private_data;
+    dev = fdata->dev;
 
-    dev = filp->private_data;
-    if (0 != mutex_lock_interruptible(&dev->lock))
+    records = kmalloc_array(batch->count, sizeof(struct aesd_write_record), GFP_KERNEL);
+    entries = kcalloc(batch->count, sizeof(struct aesd_buffer_entry), GFP_KERNEL);
+    new_ring = kmalloc(sizeof(struct aesd_ring), GFP_KERNEL);
+    if ((NULL == records) || (NULL == entries) || (NULL == new_ring))
     {
-        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
-        return -ERESTARTSYS;
+        PDEBUG("ERROR: allocating memory for a batch of %u", batch->count);
+        return_value = -ENOMEM;
+        goto exit;
     }
-    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&aesd_device.buffer,
-                                                            *f_pos, &entry_offset);
-    if (NULL != entry)
+    if (copy_from_user(records, u64_to_user_ptr(batch->records),
+                       batch->count * sizeof(struct aesd_write_record)) != 0)
     {
-        read_bytes = (entry->size - entry_offset);
-        if (read_bytes > count)
+        return_value = -EFAULT;
+        goto exit;
+    }
+    for (index = 0; index < batch->count; index++)
+    {
+        if ((0 == records[index].len) || (records[index].len > MAX_RW_COUNT))
         {
-            read_bytes = count;
+            return_value = -EINVAL;
+            goto exit;
         }
-        retval = copy_to_user(buf, (entry->buffptr + entry_offset), read_bytes);
-        if (0 != retval)
+        if ((NULL != dev->arena) && (records[index].len > dev->arena_size))
         {
-            PDEBUG("ERROR:copy_to_user retval=%zu", retval);
+            return_value = -EFBIG;
+            goto exit;
         }
-        /* update retval with number of bytes copied */
-        /* copy_to_user returns '0' on success or number of bytes not copied */
-        retval = (read_bytes - retval);
-        *f_pos += retval;
-    
+        total_size += records[index].len;
     }
-    mutex_unlock(&dev->lock);
-    return retval;
+
+    if (NULL != dev->arena)
+    {
+        /* arena commands are staged together, the arena itself is only written under lock */
+        staging = kvmalloc(total_size, GFP_KERNEL);
+        if (NULL == staging)
+        {
+            return_value = -ENOMEM;
+            goto exit;
+        }
+        total_size = 0;
+    }
+    for (index = 0; index < batch->count; index++)
+    {
+        if (NULL != dev->arena)
+        {
+            entries[index].buffptr = staging + total_size;
+            total_size += records[index].len;
+        }
+        else
+        {
+            record = aesd_record_alloc(records[index].len);
+            if (NULL == record)
+            {
+                return_value = -ENOMEM;
+                goto exit;
+            }
+            entries[index].buffptr = record->data;
+        }
+        entries[index].size = records[index].len;
+        if (copy_from_user((char *)entries[index].buffptr, u64_to_user_ptr(records[index].buf),
+                           records[index].len) != 0)
+        {
+            return_value = -EFAULT;
+            goto exit;
+        }
+    }
+
+    if (NULL != dev->arena)
+    {
+        aesd_publish_arena_entries(dev, new_ring, entries, batch->count);
+    }
+    else
+    {
+        aesd_publish_entries(dev, new_ring, entries, batch->count);
+        /* the buffptr members now name evicted records, which were already released */
+        memset(entries, 0, batch->count * sizeof(struct aesd_buffer_entry));
+    }
+    new_ring = NULL;
+    return_value = batch->count;
+    aesd_stat_inc(dev, writes);
+    aesd_stat_add(dev, write_bytes, total_size);
+
+exit:
+    if ((NULL != entries) && (NULL == dev->arena))
+    {
+        for (index = 0; index < batch->count; index++)
+        {
+            if (NULL != entries[index].buffptr)
+            {
+                aesd_record_put(aesd_record_from_buffptr(entries[index].buffptr));
+            }
+        }
+    }
+    kvfree(staging);
+    kfree(new_ring);
+    kfree(entries);
+    kfree(records);
+    return return_value;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+/**
+ * @brief Copies a description of every entry of the buffer of @param filp, oldest first, to
+ * the user array named by @param table and sets table->count.
+ */
+static long aesd_get_entries(struct file *filp, struct aesd_entry_table *table)
 {
-    ssize_t retval = 0;
-    const char *free_buffptr = NULL;
+    struct aesd_file *fdata = NULL;
     struct aesd_dev *dev = NULL;
+    struct aesd_circular_buffer *buffer = NULL;
+    const struct aesd_buffer_entry *entry = NULL;
+    struct aesd_entry_info info[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    uint64_t offset = 0;
+    uint8_t count = 0;
+    uint8_t index = 0;
 
-    if ( (NULL == filp) || (NULL == buf))
+    if ((NULL == filp) || (NULL == table))
     {
-        PDEBUG("ERROR: aesd_read invalid arguments");
+        PDEBUG("ERROR: aesd_get_entries invalid arguments");
         return -EINVAL;
     }
 
-    PDEBUG("write %zu bytes with offset %lld",count,*f_pos);
+    fdata = filp->private_data;
+    dev = fdata->dev;
 
-    dev = filp->private_data;
-    if (0 != mutex_lock_interruptible(&dev->lock))
-    {
-        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
-        return -ERESTARTSYS;
-    }
-    
-    dev->entry.buffptr = krealloc(dev->entry.buffptr, (dev->entry.size + count),
-                                  GFP_KERNEL);
-    if (NULL == dev->entry.buffptr)
+    /* one consistent snapshot, copied out after leaving the RCU read side */
+    rcu_read_lock();
+    buffer = &rcu_dereference(dev->ring)->buffer;
+    count = aesd_circular_buffer_count(buffer);
+    for (index = 0; index < count; index++)
     {
-        PDEBUG("ERROR: krealloc allocating memory");
-        retval = -ENOMEM;
-        goto exit;
+        entry = &buffer->entry[(buffer->out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        info[index].seq = entry->seq;
+        info[index].offset = offset;
+        info[index].size = entry->size;
+        info[index].timestamp_ns = entry->timestamp_ns;
+        offset += entry->size;
     }
+    rcu_read_unlock();
 
-    retval = copy_from_user((void *)(dev->entry.buffptr + dev->entry.size), buf, count);
-    if (0 != retval)
-    {
-        PDEBUG("ERROR:copy_from_user retval=%zu", retval);
-    }
-    /* update retval with number of bytes copied */
-    /* copy_to_user returns '0' on success or number of bytes not copied */
-    retval = (count - retval);
-    dev->entry.size += retval;
-    
-    /* add to circular buffer if command is terminated by new line */
-    if (dev->entry.buffptr[dev->entry.size-1] == '\n')
+    table->count = count;
+    if (copy_to_user(u64_to_user_ptr(table->entries), info,
+                     min_t(uint32_t, count, table->capacity) * sizeof(struct aesd_entry_info)) != 0)
     {
-        free_buffptr = aesd_circular_buffer_add_entry(&dev->buffer, &dev->entry);
-        /* free overwritten entry buffptr */
-        if (NULL != free_buffptr)
-        {
-            kfree(free_buffptr);
-            free_buffptr = NULL;
-        }
-        /* reset working entry */
-        dev->entry.buffptr = NULL;
-        dev->entry.size = 0;
+        return -EFAULT;
     }
-
-exit:
-    mutex_unlock(&dev->lock);
-    return retval;
+    return 0;
 }
 
-loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
+/**
+ * @brief Writes a snapshot of the buffer of @param filp to the user buffer named by
+ * @param snap and sets snap->len to its size.
+ *
+ * The snapshot is assembled under dev->lock, which keeps both records and arena bytes from
+ * being evicted, and copied to user space after the lock is dropped.
+ *
+ * @return 0 on success, -ENOSPC if snap->len was too small to hold the snapshot.
+ */
+static long aesd_snapshot(struct file *filp, struct aesd_snapshot *snap)
 {
+    struct aesd_file *fdata = NULL;
     struct aesd_dev *dev = NULL;
-    loff_t file_offset = 0;
+    struct aesd_circular_buffer *buffer = NULL;
+    const struct aesd_buffer_entry *entry = NULL;
+    struct aesd_snapshot_header *header = NULL;
+    struct aesd_snapshot_entry snap_entry;
+    char *staging = NULL;
+    size_t size = 0;
+    size_t offset = 0;
+    uint8_t count = 0;
     uint8_t index = 0;
-    struct aesd_buffer_entry *entry = NULL;
-    loff_t total_size = 0;
+    u64 wait_ns = 0;
+    long return_value = 0;
 
-    if (NULL == filp)
+    if ((NULL == filp) || (NULL == snap))
     {
-        PDEBUG("ERROR: aesd_llseek invalid arguments");
+        PDEBUG("ERROR: aesd_snapshot invalid arguments");
         return -EINVAL;
     }
 
-    dev = filp->private_data;
+    fdata = filp->private_data;
+    dev = fdata->dev;
 
-    if (0 != mutex_lock_interruptible(&dev->lock))
+    aesd_dev_lock(dev, &wait_ns);
+    buffer = &rcu_dereference_protected(dev->ring, lockdep_is_held(&dev->lock))->buffer;
+    count = aesd_circular_buffer_count(buffer);
+    /* only live entries are saved, slots removed from the arena ring are not */
+    size = sizeof(struct aesd_snapshot_header) + aesd_buffer_size(buffer) +
+           count * sizeof(struct aesd_snapshot_entry);
+    if (size > snap->len)
     {
-        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
-        return -ERESTARTSYS;
+        return_value = -ENOSPC;
+        goto unlock;
     }
-    AESD_CIRCULAR_BUFFER_FOREACH(entry,&aesd_device.buffer,index)
+    /* zeroed, no byte of kernel memory reaches user space unless it was written below */
+    staging = kvzalloc(size, GFP_KERNEL);
+    if (NULL == staging)
     {
-        total_size += entry->size;
+        return_value = -ENOMEM;
+        goto unlock;
+    }
+    header = (struct aesd_snapshot_header *)staging;
+    header->magic = AESD_SNAPSHOT_MAGIC;
+    header->version = AESD_SNAPSHOT_VERSION;
+    header->entry_count = count;
+    header->reserved = 0;
+    header->next_seq = buffer->next_seq;
+    offset = sizeof(struct aesd_snapshot_header);
+    for (index = 0; index < count; index++)
+    {
+        entry = &buffer->entry[(buffer->out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+        /* entry headers follow data of any length, so they are copied rather than aligned */
+        snap_entry.seq = entry->seq;
+        snap_entry.timestamp_ns = entry->timestamp_ns;
+        snap_entry.size = entry->size;
+        memcpy(staging + offset, &snap_entry, sizeof(struct aesd_snapshot_entry));
+        offset += sizeof(struct aesd_snapshot_entry);
+        memcpy(staging + offset, entry->buffptr, entry->size);
+        offset += entry->size;
     }
-    mutex_unlock(&dev->lock);
-
-    file_offset = fixed_size_llseek(filp, offset, whence, total_size);
-    
-    return file_offset;
 
+unlock:
+    mutex_unlock(&dev->lock);
+    /* the bytes assembled, or the room needed when the snapshot was not assembled */
+    snap->len = (0 == return_value) ? offset : size;
+    if ((0 == return_value) &&
+        (copy_to_user(u64_to_user_ptr(snap->buf), staging, offset) != 0))
+    {
+        return_value = -EFAULT;
+    }
+    kvfree(staging);
+    return return_value;
 }
 
-static long aesd_adjust_file_offset(struct file *filp, unsigned int write_cmd,
-                                    unsigned int write_cmd_offset)
+/**
+ * @brief Fills the buffer of @param filp with the entries of the snapshot named by
+ * @param snap, keeping their sequence numbers and commit times.
+ *
+ * Only a device nothing was written to since it was loaded can be restored, so restoring
+ * never interleaves with entries written by clients.  The snapshot is validated completely
+ * and every entry is allocated before the ring is touched.
+ *
+ * @return the number of entries restored, -EBADF if @param filp is not open for writing,
+ * -EBUSY if the device was written to already,
+ * -EINVAL if the snapshot is malformed or -EFBIG if it does not fit the arena.
+ */
+static long aesd_restore(struct file *filp, const struct aesd_snapshot *snap)
 {
+    struct aesd_file *fdata = NULL;
     struct aesd_dev *dev = NULL;
+    struct aesd_ring *old_ring = NULL;
+    struct aesd_ring *new_ring = NULL;
+    struct aesd_buffer_entry entries[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    const struct aesd_snapshot_header *header = NULL;
+    struct aesd_snapshot_entry snap_entry;
+    struct aesd_record *record = NULL;
+    char *staging = NULL;
+    size_t offset = 0;
+    size_t total_size = 0;
+    uint32_t count = 0;
+    uint32_t index = 0;
+    uint32_t allocated = 0;
+    u64 wait_ns = 0;
     long return_value = 0;
-    uint8_t index = 0;
-    struct aesd_buffer_entry *entry = NULL;
 
-    if (NULL == filp)
+    if ((NULL == filp) || (NULL == snap))
+    {
+        PDEBUG("ERROR: aesd_restore invalid arguments");
+        return -EINVAL;
+    }
+    if (!(filp->f_mode & FMODE_WRITE))
+    {
+        return -EBADF;
+    }
+    if ((snap->len < sizeof(struct aesd_snapshot_header)) || (snap->len > MAX_RW_COUNT))
     {
-        PDEBUG("ERROR: aesd_adjust_file_offset invalid arguments");
         return -EINVAL;
     }
 
-    dev = filp->private_data;
+    fdata = filp->private_data;
+    dev = fdata->dev;
+    memset(entries, 0, sizeof(entries));
 
-    if (0 != mutex_lock_interruptible(&dev->lock))
+    staging = kvmalloc(snap->len, GFP_KERNEL);
+    new_ring = kmalloc(sizeof(struct aesd_ring), GFP_KERNEL);
+    if ((NULL == staging) || (NULL == new_ring))
     {
-        PDEBUG("ERROR: mutex_lock_interruptible acquiring lock");
-        return -ERESTARTSYS;
+        return_value = -ENOMEM;
+        goto exit;
     }
-    /* Get the total entries count in circular buffer in index */
-    AESD_CIRCULAR_BUFFER_FOREACH(entry,&aesd_device.buffer,index)
+    if (copy_from_user(staging, u64_to_user_ptr(snap->buf), snap->len) != 0)
     {
-        
+        return_value = -EFAULT;
+        goto exit;
     }
-    
-    if ( (write_cmd > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) ||
-         (write_cmd > index) ||
-         (write_cmd_offset >= dev->buffer.entry[write_cmd].size) )
+
+    /* entries must be complete, consecutive up to next_seq and in commit order */
+    header = (const struct aesd_snapshot_header *)staging;
+    count = header->entry_count;
+    if ((AESD_SNAPSHOT_MAGIC != header->magic) || (AESD_SNAPSHOT_VERSION != header->version) ||
+        (count > AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED) || (count > header->next_seq))
     {
         return_value = -EINVAL;
         goto exit;
     }
-    
-    for (index = 0; index < write_cmd; index++)
+    offset = sizeof(struct aesd_snapshot_header);
+    for (index = 0; index < count; index++)
+    {
+        if ((snap->len - offset) < sizeof(struct aesd_snapshot_entry))
+        {
+            return_value = -EINVAL;
+            goto exit;
+        }
+        memcpy(&snap_entry, staging + offset, sizeof(struct aesd_snapshot_entry));
+        offset += sizeof(struct aesd_snapshot_entry);
+        if ((0 == snap_entry.size) || (snap_entry.size > (snap->len - offset)) ||
+            (snap_entry.seq != (header->next_seq - count + index)) ||
+            ((0 != index) && (snap_entry.timestamp_ns < entries[index - 1].timestamp_ns)))
+        {
+            return_value = -EINVAL;
+            goto exit;
+        }
+        entries[index].buffptr = staging + offset;
+        entries[index].size = snap_entry.size;
+        entries[index].timestamp_ns = snap_entry.timestamp_ns;
+        offset += snap_entry.size;
+        total_size += snap_entry.size;
+    }
+    if ((NULL != dev->arena) && (total_size > dev->arena_size))
+    {
+        return_value = -EFBIG;
+        goto exit;
+    }
+    if (NULL == dev->arena)
     {
-        filp->f_pos += dev->buffer.entry[index].size;
+        for (allocated = 0; allocated < count; allocated++)
+        {
+            record = aesd_record_alloc(entries[allocated].size);
+            if (NULL == record)
+            {
+                return_value = -ENOMEM;
+                goto exit;
+            }
+            memcpy(record->data, entries[allocated].buffptr, entries[allocated].size);
+            entries[allocated].buffptr = record->data;
+        }
     }
-    filp->f_pos += write_cmd_offset;
 
-exit:
+    aesd_dev_lock(dev, &wait_ns);
+    old_ring = rcu_dereference_protected(dev->ring, lockdep_is_held(&dev->lock));
+    if (0 != old_ring->buffer.next_seq)
+    {
+        mutex_unlock(&dev->lock);
+        return_value = -EBUSY;
+        goto exit;
+    }
+    aesd_circular_buffer_init(&new_ring->buffer);
+    new_ring->buffer.next_seq = header->next_seq - count;
+    dev->arena_tail = 0;
+    for (index = 0; index < count; index++)
+    {
+        if (NULL != dev->arena)
+        {
+            /* the arena is empty, entries are laid out from its start */
+            memcpy(dev->arena + dev->arena_tail, entries[index].buffptr, entries[index].size);
+            entries[index].buffptr = dev->arena + dev->arena_tail;
+            dev->arena_tail += entries[index].size;
+        }
+        aesd_circular_buffer_add_entry(&new_ring->buffer, &entries[index]);
+    }
+    if (NULL != dev->arena)
+    {
+        WRITE_ONCE(dev->arena_first_seq, aesd_circular_buffer_first_seq(&new_ring->buffer));
+        aesd_arena_update_header(dev, &new_ring->buffer);
+    }
+    rcu_assign_pointer(dev->ring, new_ring);
     mutex_unlock(&dev->lock);
+
+    kfree_rcu(old_ring, rcu);
+    new_ring = NULL;
+    return_value = count;
+    /* the ring holds the records now */
+    allocated = 0;
+
+exit:
+    for (index = 0; index < allocated; index++)
+    {
+        aesd_record_put(aesd_record_from_buffptr(entries[index].buffptr));
+    }
+    kfree(new_ring);
+    kvfree(staging);
     return return_value;
 }
 
@@ -238,6 +1489,11 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
     long return_value = 0;
  	struct aesd_seekto seek_data;
+ 	struct aesd_cursor cursor;
+ 	struct aesd_write_batch batch;
+ 	struct aesd_entry_table table;
+ 	struct aesd_seektime seek_time;
+ 	struct aesd_snapshot snap;
  	
     if (NULL == filp)
     {
@@ -265,6 +1521,77 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
         {
             return_value = aesd_adjust_file_offset(filp, seek_data.write_cmd, seek_data.write_cmd_offset);
         }
+        break;
+
+ 	    case AESDCHAR_IOCGCURSOR:
+        return_value = aesd_get_cursor(filp, &cursor);
+        if ((0 == return_value) &&
+            (copy_to_user((void __user *)arg, &cursor, sizeof(cursor)) != 0))
+        {
+            return_value = -EFAULT;
+        }
+        break;
+
+ 	    case AESDCHAR_IOCWRBATCH:
+        if (copy_from_user(&batch, (const void __user *)arg, sizeof(batch)) != 0)
+        {
+            return_value = -EFAULT;
+        }
+        else
+        {
+            return_value = aesd_write_batch(filp, &batch);
+        }
+        break;
+
+ 	    case AESDCHAR_IOCGENTRIES:
+        if (copy_from_user(&table, (const void __user *)arg, sizeof(table)) != 0)
+        {
+            return_value = -EFAULT;
+            break;
+        }
+        return_value = aesd_get_entries(filp, &table);
+        if ((0 == return_value) &&
+            (copy_to_user((void __user *)arg, &table, sizeof(table)) != 0))
+        {
+            return_value = -EFAULT;
+        }
+        break;
+
+ 	    case AESDCHAR_IOCSEEKTIME:
+        if (copy_from_user(&seek_time, (const void __user *)arg, sizeof(seek_time)) != 0)
+        {
+            return_value = -EFAULT;
+        }
+        else
+        {
+            return_value = aesd_seek_time(filp, seek_time.timestamp_ns);
+        }
+        break;
+
+ 	    case AESDCHAR_IOCSNAPSHOT:
+        if (copy_from_user(&snap, (const void __user *)arg, sizeof(snap)) != 0)
+        {
+            return_value = -EFAULT;
+            break;
+        }
+        return_value = aesd_snapshot(filp, &snap);
+        /* the size is reported back when the buffer was too small as well */
+        if (((0 == return_value) || (-ENOSPC == return_value)) &&
+            (copy_to_user((void __user *)arg, &snap, sizeof(snap)) != 0))
+        {
+            return_value = -EFAULT;
+        }
+        break;
+
+ 	    case AESDCHAR_IOCRESTORE:
+        if (copy_from_user(&snap, (const void __user *)arg, sizeof(snap)) != 0)
+        {
+            return_value = -EFAULT;
+        }
+        else
+        {
+            return_value = aesd_restore(filp, &snap);
+        }
         break;
 
  	    default:
@@ -274,76 +1601,272 @@ long aesd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
  	return return_value;
 }
 
+/**
+ * @brief Maps the arena of the device read only, preceded by its header page.
+ * Only available when the module was loaded with a non zero aesd_arena_size.
+ */
+static int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_file *fdata = NULL;
+    struct aesd_dev *dev = NULL;
+
+    if ((NULL == filp) || (NULL == vma))
+    {
+        PDEBUG("ERROR: aesd_mmap invalid arguments");
+        return -EINVAL;
+    }
+
+    fdata = filp->private_data;
+    dev = fdata->dev;
+    if (NULL == dev->arena)
+    {
+        return -ENODEV;
+    }
+    if (vma->vm_flags & VM_WRITE)
+    {
+        return -EPERM;
+    }
+    /* keep mprotect from making the mapping writable later */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+    return remap_vmalloc_range(vma, dev->mmap_header, vma->vm_pgoff);
+}
+
 struct file_operations aesd_fops = {
     .owner =    THIS_MODULE,
-    .read =     aesd_read,
-    .write =    aesd_write,
+    .read_iter = aesd_read_iter,
+    .write_iter = aesd_write_iter,
     .open =     aesd_open,
     .release =  aesd_release,
     .llseek = aesd_llseek,
-    .unlocked_ioctl = aesd_ioctl
+    .unlocked_ioctl = aesd_ioctl,
+    .mmap =     aesd_mmap,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read
+#else
+    .splice_read = generic_file_splice_read
+#endif
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+/**
+ * @brief Prints the counters of the device, summed over all CPUs, and the current ring
+ * occupancy.  Counters are read without stopping writers, so they are only approximate.
+ */
+static int aesd_stats_show(struct seq_file *s, void *unused)
+{
+    struct aesd_dev *dev = s->private;
+    struct aesd_stats total;
+    const struct aesd_stats *stats = NULL;
+    struct aesd_circular_buffer *buffer = NULL;
+    uint8_t entries = 0;
+    loff_t bytes = 0;
+    int cpu;
+
+    memset(&total, 0, sizeof(total));
+    for_each_possible_cpu(cpu)
+    {
+        stats = per_cpu_ptr(dev->stats, cpu);
+        total.reads += stats->reads;
+        total.read_bytes += stats->read_bytes;
+        total.writes += stats->writes;
+        total.write_bytes += stats->write_bytes;
+        total.evictions += stats->evictions;
+        total.reallocs += stats->reallocs;
+        total.restarts += stats->restarts;
+        total.lock_waits += stats->lock_waits;
+        total.lock_wait_ns += stats->lock_wait_ns;
+    }
+    rcu_read_lock();
+    buffer = &rcu_dereference(dev->ring)->buffer;
+    entries = aesd_circular_buffer_count(buffer);
+    bytes = aesd_buffer_size(buffer);
+    rcu_read_unlock();
+
+    seq_printf(s, "reads: %llu\n", total.reads);
+    seq_printf(s, "read_bytes: %llu\n", total.read_bytes);
+    seq_printf(s, "writes: %llu\n", total.writes);
+    seq_printf(s, "write_bytes: %llu\n", total.write_bytes);
+    seq_printf(s, "evictions: %llu\n", total.evictions);
+    seq_printf(s, "reallocs: %llu\n", total.reallocs);
+    seq_printf(s, "restarts: %llu\n", total.restarts);
+    seq_printf(s, "lock_waits: %llu\n", total.lock_waits);
+    seq_printf(s, "lock_wait_ns: %llu\n", total.lock_wait_ns);
+    seq_printf(s, "entries: %u/%u\n", entries, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    seq_printf(s, "bytes: %lld\n", bytes);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
     }
     return err;
 }
 
+/**
+ * @brief Allocates the buffer of @param dev and registers it as device @param index
+ */
+static int aesd_init_device(struct aesd_dev *dev, unsigned int index)
+{
+    int result;
+    struct aesd_ring *ring = NULL;
+    char name[16];
+
+    dev->stats = alloc_percpu(struct aesd_stats);
+    if (NULL == dev->stats) {
+        return -ENOMEM;
+    }
+    ring = kmalloc(sizeof(struct aesd_ring), GFP_KERNEL);
+    if (NULL == ring) {
+        free_percpu(dev->stats);
+        return -ENOMEM;
+    }
+    aesd_circular_buffer_init(&ring->buffer);
+    if (0 != aesd_arena_size) {
+        /* header page followed by the arena, zeroed and mappable to user space */
+        dev->arena_size = PAGE_ALIGN(aesd_arena_size);
+        dev->mmap_header = vmalloc_user(PAGE_SIZE + dev->arena_size);
+        if (NULL == dev->mmap_header) {
+            kfree(ring);
+            free_percpu(dev->stats);
+            return -ENOMEM;
+        }
+        dev->arena = (char *)dev->mmap_header + PAGE_SIZE;
+        dev->mmap_header->data_size = dev->arena_size;
+    }
+    RCU_INIT_POINTER(dev->ring, ring);
+    mutex_init(&dev->lock);
+    mutex_init(&dev->entry_lock);
+    
+    result = aesd_setup_cdev(dev, index);
+
+    if( result ) {
+        mutex_destroy(&dev->lock);
+        mutex_destroy(&dev->entry_lock);
+        vfree(dev->mmap_header);
+        kfree(ring);
+        free_percpu(dev->stats);
+        return result;
+    }
+
+    /* debugfs is best effort, the device works without it */
+    snprintf(name, sizeof(name), "aesdchar%u", index);
+    dev->debugfs_dir = debugfs_create_dir(name, aesd_debugfs_root);
+    debugfs_create_file("stats", 0444, dev->debugfs_dir, dev, &aesd_stats_fops);
+    return 0;
+}
+
+/**
+ * @brief Removes @param dev and frees its buffer
+ */
+static void aesd_cleanup_device(struct aesd_dev *dev)
+{
+    uint8_t index = 0;
+    struct aesd_buffer_entry *entry = NULL;
+    struct aesd_ring *ring = NULL;
+
+    debugfs_remove_recursive(dev->debugfs_dir);
+    cdev_del(&dev->cdev);
 
+    mutex_destroy(&dev->lock);
+    mutex_destroy(&dev->entry_lock);
+    /* no files are open, nothing else can reach the ring */
+    ring = rcu_dereference_protected(dev->ring, 1);
+    AESD_CIRCULAR_BUFFER_FOREACH(entry,&ring->buffer,index)
+    {
+        /* arena entries are freed with the arena */
+        if ((NULL != entry->buffptr) && (NULL == dev->arena))
+        {
+            aesd_record_put(aesd_record_from_buffptr(entry->buffptr));
+            entry->buffptr = NULL;
+        }
+    }
+    kfree(ring);
+    vfree(dev->mmap_header);
+    aesd_pending_free(&dev->pending);
+    free_percpu(dev->stats);
+}
 
 int aesd_init_module(void)
 {
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    unsigned int index = 0;
+
+    BUILD_BUG_ON(AESD_MMAP_MAX_ENTRIES != AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED);
+    BUILD_BUG_ON(sizeof(struct aesd_mmap_header) > PAGE_SIZE);
+    if (0 == aesd_nr_devs) {
+        return -EINVAL;
+    }
+    result = alloc_chrdev_region(&dev, aesd_minor, aesd_nr_devs,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
+    aesd_devices = kcalloc(aesd_nr_devs, sizeof(struct aesd_dev), GFP_KERNEL);
+    if (NULL == aesd_devices) {
+        result = -ENOMEM;
+        goto fail_devices;
+    }
 
-    mutex_init(&aesd_device.lock);
-    aesd_circular_buffer_init(&aesd_device.buffer);
-    
-    result = aesd_setup_cdev(&aesd_device);
+    aesd_record_cache = kmem_cache_create("aesd_record", AESD_RECORD_CACHE_SIZE, 0,
+                                          SLAB_HWCACHE_ALIGN, NULL);
+    if (NULL == aesd_record_cache) {
+        result = -ENOMEM;
+        goto fail_cache;
+    }
 
-    if( result ) {
-        unregister_chrdev_region(dev, 1);
+    aesd_debugfs_root = debugfs_create_dir("aesdchar", NULL);
+    for (index = 0; index < aesd_nr_devs; index++) {
+        result = aesd_init_device(&aesd_devices[index], index);
+        if( result ) {
+            goto fail_device;
+        }
+    }
+    return 0;
+
+fail_device:
+    while (index > 0) {
+        aesd_cleanup_device(&aesd_devices[--index]);
     }
+    debugfs_remove_recursive(aesd_debugfs_root);
+    rcu_barrier();
+    kmem_cache_destroy(aesd_record_cache);
+fail_cache:
+    kfree(aesd_devices);
+fail_devices:
+    unregister_chrdev_region(dev, aesd_nr_devs);
     return result;
 
 }
 
 void aesd_cleanup_module(void)
 {
-    uint8_t index = 0;
-    struct aesd_buffer_entry *entry = NULL;
-
+    unsigned int index = 0;
     dev_t devno = MKDEV(aesd_major, aesd_minor);
 
-    cdev_del(&aesd_device.cdev);
-
-    mutex_destroy(&aesd_device.lock);
-    AESD_CIRCULAR_BUFFER_FOREACH(entry,&aesd_device.buffer,index)
-    {
-        if (NULL != entry->buffptr)
-        {
-            kfree(entry->buffptr);
-            entry->buffptr = NULL;
-        }
+    for (index = 0; index < aesd_nr_devs; index++) {
+        aesd_cleanup_device(&aesd_devices[index]);
     }
-    unregister_chrdev_region(devno, 1);
+    debugfs_remove_recursive(aesd_debugfs_root);
+    kfree(aesd_devices);
+    /* wait for records queued by aesd_record_put before destroying their cache */
+    rcu_barrier();
+    kmem_cache_destroy(aesd_record_cache);
+    unregister_chrdev_region(devno, aesd_nr_devs);
 }
 
 
@@ -0,0 +1,835 @@
+/**
+ * @file aesdsocket-backend.c
+ * @brief Storage backends of aesdsocket: a flat file, the aesdchar device and an in memory
+ * circular buffer.
+ *
+ * The memory backend follows the aesdchar semantics with the circular buffer of the driver,
+ * so the network path can be measured without the cost of a file system or the module.
+ * Every backend assembles packets per connection and stores them once their new line arrived,
+ * so an unterminated packet never reaches the storage and is dropped with its connection.
+ */
+
+/* Header files */
+#define _GNU_SOURCE /* splice */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include "aesdsocket-backend.h"
+#include "aesdsocket-budget.h"
+#include "../aesd-char-driver/aesd-circular-buffer.h"
+#include "../aesd-char-driver/aesd_ioctl.h"
+
+/* Macro definitions */
+
+#define SUCCESS      (0)
+#define FAILURE      (-1)
+
+#define FILE_BACKEND_PATH      "/var/tmp/aesdsocketdata"
+#define CHARDEV_BACKEND_PATH   "/dev/aesdchar"
+
+/* replay buffer of a connection, on the heap so thread stacks stay small */
+#define SEND_BUFFER_LEN   (16 * 1024)
+#define SPLICE_CHUNK_LEN     (65536)
+#define SPLICE_UNSUPPORTED   (-2)
+
+struct backend_conn {
+    /**
+     * Open file or device, -1 for the memory backend
+     */
+    int fd;
+    /**
+     * Memory backend read position, in bytes of the concatenated packets
+     */
+    size_t pos;
+    /**
+     * Packet received so far, stored when it ends with a new line
+     */
+    char *pending;
+    size_t pending_size;
+    /**
+     * Buffer of send_file, allocated on the first replay without splice
+     */
+    char *send_buffer;
+};
+
+/* Global definitions */
+
+/* serializes appends to the flat file */
+static pthread_mutex_t file_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* memory backend storage, the buffer and all connection positions are protected by memory_mutex */
+static pthread_mutex_t memory_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct aesd_circular_buffer memory_buffer;
+
+/* Function definitions */
+
+/**
+ * @brief Allocates @param size bytes reserved from the memory budget, released with
+ * budget_free
+ */
+static void *budget_malloc(size_t size)
+{
+    void *data = NULL;
+
+    if (!budget_reserve(size))
+    {
+        syslog(LOG_ERR, "Memory budget exceeded by %zu bytes", size);
+        return NULL;
+    }
+    data = malloc(size);
+    if (NULL == data)
+    {
+        budget_charge(-(ssize_t)size);
+        syslog(LOG_PERROR, "malloc: %s", strerror(errno));
+    }
+    return data;
+}
+
+/**
+ * @brief Frees @param data of @param size bytes allocated with budget_malloc
+ */
+static void budget_free(void *data, size_t size)
+{
+    if (NULL != data)
+    {
+        budget_charge(-(ssize_t)size);
+        free(data);
+    }
+}
+
+/**
+ * @brief Allocates a connection context around @param fd
+ */
+static backend_conn_t *conn_alloc(int fd)
+{
+    backend_conn_t *conn = budget_malloc(sizeof(*conn));
+
+    if (NULL == conn)
+    {
+        return NULL;
+    }
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = fd;
+    return conn;
+}
+
+/**
+ * @brief Frees @param conn with the unterminated packet and the buffer it holds
+ */
+static void conn_free(backend_conn_t *conn)
+{
+    budget_free(conn->pending, conn->pending_size);
+    budget_free(conn->send_buffer, SEND_BUFFER_LEN);
+    budget_free(conn, sizeof(*conn));
+}
+
+/**
+ * @brief Adds the @param len bytes at @param buf to the packet @param conn assembles.  Once the
+ * packet ends with a new line it is returned in @param packet_rtn and @param size_rtn, straight
+ * from @param buf when it arrived in one piece, otherwise as conn->pending, which the caller
+ * releases with conn_stored.  @param packet_rtn is NULL while the packet is unterminated.
+ *
+ * @return SUCCESS or FAILURE if the packet could not be grown.
+ */
+static int conn_assemble(backend_conn_t *conn, const char *buf, size_t len,
+                         const char **packet_rtn, size_t *size_rtn)
+{
+    char *pending = NULL;
+
+    *packet_rtn = NULL;
+    *size_rtn = 0;
+    if (0 == len)
+    {
+        return SUCCESS;
+    }
+    if ((0 == conn->pending_size) && ('\n' == buf[len - 1]))
+    {
+        *packet_rtn = buf;
+        *size_rtn = len;
+        return SUCCESS;
+    }
+    if (!budget_reserve(len))
+    {
+        syslog(LOG_ERR, "Memory budget exceeded by a packet of %zu bytes", conn->pending_size + len);
+        return FAILURE;
+    }
+    pending = realloc(conn->pending, conn->pending_size + len);
+    if (NULL == pending)
+    {
+        budget_charge(-(ssize_t)len);
+        syslog(LOG_PERROR, "realloc: %s", strerror(errno));
+        return FAILURE;
+    }
+    memcpy(pending + conn->pending_size, buf, len);
+    conn->pending = pending;
+    conn->pending_size += len;
+    if ('\n' == conn->pending[conn->pending_size - 1])
+    {
+        *packet_rtn = conn->pending;
+        *size_rtn = conn->pending_size;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Releases the packet conn_assemble returned for @param conn once it was stored
+ */
+static void conn_stored(backend_conn_t *conn)
+{
+    budget_free(conn->pending, conn->pending_size);
+    conn->pending = NULL;
+    conn->pending_size = 0;
+}
+
+/**
+ * @brief Sends @param len bytes of @param buf to @param connection_fd
+ */
+static int send_all(int connection_fd, const char *buf, size_t len)
+{
+    ssize_t send_bytes = 0;
+
+    while (len > 0)
+    {
+        send_bytes = send(connection_fd, buf, len, 0);
+        if (send_bytes <= 0)
+        {
+            syslog(LOG_PERROR, "send: %s", strerror(errno));
+            return FAILURE;
+        }
+        buf += send_bytes;
+        len -= send_bytes;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Reads @param file_fd from its current offset until EOF and sends it to @param connection_fd,
+ * announcing each chunk to @param chunk unless it is NULL.  The data goes through the send
+ * buffer of @param conn, charged to the memory budget until the connection is closed.
+ */
+static int send_file(backend_conn_t *conn, int file_fd, int connection_fd, backend_chunk_fn chunk)
+{
+    char *buffer = conn->send_buffer;
+    ssize_t read_bytes = 0;
+
+    if (NULL == buffer)
+    {
+        buffer = budget_malloc(SEND_BUFFER_LEN);
+        if (NULL == buffer)
+        {
+            return FAILURE;
+        }
+        conn->send_buffer = buffer;
+    }
+    do
+    {
+        read_bytes = read(file_fd, buffer, SEND_BUFFER_LEN);
+        if (FAILURE == read_bytes)
+        {
+            syslog(LOG_PERROR, "read: %s", strerror(errno));
+            return FAILURE;
+        }
+        if ((read_bytes > 0) && (NULL != chunk) && (SUCCESS != chunk(connection_fd, read_bytes)))
+        {
+            return FAILURE;
+        }
+        if (SUCCESS != send_all(connection_fd, buffer, read_bytes))
+        {
+            return FAILURE;
+        }
+    } while (read_bytes > 0);
+    return SUCCESS;
+}
+
+/**
+ * @brief Sends file contents from the current offset to the socket with splice,
+ *        through a pipe, so the data is never copied into user space.
+ *
+ * @param file_fd file to read until EOF.
+ * @param connection_fd socket to send to.
+ * @param chunk called before each spliced chunk is sent, may be NULL.
+ *
+ * @return int - SUCCESS, FAILURE, or SPLICE_UNSUPPORTED when nothing was sent
+ *               and the caller should fall back to read and send.
+ */
+static int splice_to_socket(int file_fd, int connection_fd, backend_chunk_fn chunk)
+{
+    int pipe_fds[2] = {-1, -1};
+    ssize_t spliced_bytes = 0;
+    ssize_t sent_bytes = 0;
+    bool sent_data = false;
+    int status = SUCCESS;
+
+    if (FAILURE == pipe(pipe_fds))
+    {
+        syslog(LOG_PERROR, "pipe: %s", strerror(errno));
+        return SPLICE_UNSUPPORTED;
+    }
+    while (SUCCESS == status)
+    {
+        spliced_bytes = splice(file_fd, NULL, pipe_fds[1], NULL, SPLICE_CHUNK_LEN,
+                               SPLICE_F_MOVE);
+        if (FAILURE == spliced_bytes)
+        {
+            if ((EINVAL == errno) && (!sent_data))
+            {
+                /* driver without splice support */
+                status = SPLICE_UNSUPPORTED;
+            }
+            else
+            {
+                syslog(LOG_PERROR, "splice: %s", strerror(errno));
+                status = FAILURE;
+            }
+        }
+        else if (0 == spliced_bytes)
+        {
+            /* end of file */
+            break;
+        }
+        else if ((NULL != chunk) && (SUCCESS != chunk(connection_fd, spliced_bytes)))
+        {
+            status = FAILURE;
+        }
+        /* drain the pipe into the socket */
+        while ((SUCCESS == status) && (spliced_bytes > 0))
+        {
+            sent_bytes = splice(pipe_fds[0], NULL, connection_fd, NULL, spliced_bytes,
+                                SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (sent_bytes <= 0)
+            {
+                syslog(LOG_PERROR, "splice: %s", strerror(errno));
+                status = FAILURE;
+            }
+            else
+            {
+                spliced_bytes -= sent_bytes;
+                sent_data = true;
+            }
+        }
+    }
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    return status;
+}
+
+/**
+ * @brief Closes the descriptor of @param conn and frees it, dropping an unterminated packet
+ */
+static void fd_close(backend_conn_t *conn)
+{
+    if (-1 != conn->fd)
+    {
+        close(conn->fd);
+    }
+    conn_free(conn);
+}
+
+/* Flat file backend */
+
+static backend_conn_t *file_open(void)
+{
+    backend_conn_t *conn = NULL;
+    /* open file in readwrite mode */
+    int fd = open(FILE_BACKEND_PATH, O_CREAT|O_RDWR|O_APPEND,
+                  S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
+    if (FAILURE == fd)
+    {
+        syslog(LOG_ERR, "Error opening %s file: %s", FILE_BACKEND_PATH, strerror(errno));
+        return NULL;
+    }
+    conn = conn_alloc(fd);
+    if (NULL == conn)
+    {
+        close(fd);
+    }
+    return conn;
+}
+
+/**
+ * @brief Writes the @param len bytes at @param buf to the file as they are
+ */
+static int file_write(backend_conn_t *conn, const char *buf, size_t len)
+{
+    ssize_t written_bytes = 0;
+
+    if (SUCCESS != pthread_mutex_lock(&file_mutex))
+    {
+        syslog(LOG_PERROR, "pthread_mutex_lock: %s", strerror(errno));
+        return FAILURE;
+    }
+    written_bytes = write(conn->fd, buf, len);
+    pthread_mutex_unlock(&file_mutex);
+    if (written_bytes != len)
+    {
+        syslog(LOG_ERR, "Error writing to %s file: %s", FILE_BACKEND_PATH, strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+static int file_append(backend_conn_t *conn, const char *buf, size_t len)
+{
+    const char *packet = NULL;
+    size_t size = 0;
+    int status = SUCCESS;
+
+    if (SUCCESS != conn_assemble(conn, buf, len, &packet, &size))
+    {
+        return FAILURE;
+    }
+    if (NULL != packet)
+    {
+        status = file_write(conn, packet, size);
+        conn_stored(conn);
+    }
+    return status;
+}
+
+static int file_append_batch(backend_conn_t *conn, const struct iovec *records, size_t count)
+{
+    size_t index = 0;
+    int status = SUCCESS;
+
+    /* a flat file has no packet boundaries, records are stored back to back */
+    for (index = 0; (index < count) && (SUCCESS == status); index++)
+    {
+        status = file_write(conn, records[index].iov_base, records[index].iov_len);
+    }
+    return status;
+}
+
+static int file_replay(backend_conn_t *conn, int connection_fd, backend_chunk_fn chunk)
+{
+    int status = FAILURE;
+    /* open file in read mode, the whole file is sent */
+    int fd = open(FILE_BACKEND_PATH, O_RDONLY);
+    if (FAILURE == fd)
+    {
+        syslog(LOG_ERR, "Error opening %s file: %s for read", FILE_BACKEND_PATH, strerror(errno));
+        return FAILURE;
+    }
+    status = send_file(conn, fd, connection_fd, chunk);
+    close(fd);
+    return status;
+}
+
+static void file_cleanup(void)
+{
+    /* deletes the file */
+    if (FAILURE == unlink(FILE_BACKEND_PATH))
+    {
+       syslog(LOG_PERROR, "unlink %s: %s", FILE_BACKEND_PATH, strerror(errno));
+    }
+}
+
+/* aesdchar backend */
+
+static backend_conn_t *chardev_open(void)
+{
+    backend_conn_t *conn = NULL;
+    int fd = open(CHARDEV_BACKEND_PATH, O_RDWR);
+    if (FAILURE == fd)
+    {
+        syslog(LOG_ERR, "Error opening %s: %s", CHARDEV_BACKEND_PATH, strerror(errno));
+        return NULL;
+    }
+    conn = conn_alloc(fd);
+    if (NULL == conn)
+    {
+        close(fd);
+    }
+    return conn;
+}
+
+static int chardev_append(backend_conn_t *conn, const char *buf, size_t len)
+{
+    const char *packet = NULL;
+    size_t size = 0;
+    ssize_t written_bytes = 0;
+    int status = SUCCESS;
+
+    /* the driver hands partial packets of a closed file to the next writer, so only whole
+     * packets are written, each with a single write */
+    if (SUCCESS != conn_assemble(conn, buf, len, &packet, &size))
+    {
+        return FAILURE;
+    }
+    if (NULL != packet)
+    {
+        written_bytes = write(conn->fd, packet, size);
+        if (written_bytes != size)
+        {
+            syslog(LOG_ERR, "Error writing to %s: %s", CHARDEV_BACKEND_PATH, strerror(errno));
+            status = FAILURE;
+        }
+        conn_stored(conn);
+    }
+    return status;
+}
+
+static int chardev_append_batch(backend_conn_t *conn, const struct iovec *records, size_t count)
+{
+    struct aesd_write_record batch_records[AESD_WRITE_BATCH_MAX];
+    struct aesd_write_batch batch;
+    size_t done = 0;
+    size_t index = 0;
+    int status = SUCCESS;
+
+    /* AESDCHAR_IOCWRBATCH takes up to AESD_WRITE_BATCH_MAX records per call */
+    while ((done < count) && (SUCCESS == status))
+    {
+        batch.count = ((count - done) < AESD_WRITE_BATCH_MAX) ? (count - done) : AESD_WRITE_BATCH_MAX;
+        batch.flags = 0;
+        batch.records = (uintptr_t)batch_records;
+        for (index = 0; index < batch.count; index++)
+        {
+            batch_records[index].buf = (uintptr_t)records[done + index].iov_base;
+            batch_records[index].len = records[done + index].iov_len;
+        }
+        if (FAILURE == ioctl(conn->fd, AESDCHAR_IOCWRBATCH, &batch))
+        {
+            syslog(LOG_PERROR, "ioctl: %s", strerror(errno));
+            status = FAILURE;
+        }
+        done += batch.count;
+    }
+    return status;
+}
+
+static int chardev_replay(backend_conn_t *conn, int connection_fd, backend_chunk_fn chunk)
+{
+    int status = splice_to_socket(conn->fd, connection_fd, chunk);
+    if (SPLICE_UNSUPPORTED != status)
+    {
+        return status;
+    }
+    return send_file(conn, conn->fd, connection_fd, chunk);
+}
+
+static int chardev_seek(backend_conn_t *conn, uint32_t write_cmd, uint32_t write_cmd_offset)
+{
+    struct aesd_seekto seek_info;
+
+    seek_info.write_cmd = write_cmd;
+    seek_info.write_cmd_offset = write_cmd_offset;
+    if (SUCCESS != ioctl(conn->fd, AESDCHAR_IOCSEEKTO, &seek_info))
+    {
+        syslog(LOG_PERROR, "ioctl: %s", strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+static int chardev_rewind(backend_conn_t *conn)
+{
+    if (FAILURE == lseek(conn->fd, 0, SEEK_SET))
+    {
+        syslog(LOG_PERROR, "lseek: %s", strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+static int chardev_tail(backend_conn_t *conn, uint32_t count)
+{
+    struct aesd_entry_info info[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    struct aesd_entry_table table;
+    uint32_t first = 0;
+    off_t offset = 0;
+
+    table.entries = (uintptr_t)info;
+    table.capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    table.count = 0;
+    if (FAILURE == ioctl(conn->fd, AESDCHAR_IOCGENTRIES, &table))
+    {
+        syslog(LOG_PERROR, "ioctl: %s", strerror(errno));
+        return FAILURE;
+    }
+    if (table.count > table.capacity)
+    {
+        table.count = table.capacity;
+    }
+    /* all packets when fewer than count are kept */
+    if (count < table.count)
+    {
+        first = table.count - count;
+        offset = info[first].offset;
+    }
+    if (FAILURE == lseek(conn->fd, offset, SEEK_SET))
+    {
+        syslog(LOG_PERROR, "lseek: %s", strerror(errno));
+        return FAILURE;
+    }
+    return SUCCESS;
+}
+
+/* In memory backend */
+
+/**
+ * @brief Returns packet @param index counted from the oldest one.  Caller must hold memory_mutex.
+ */
+static struct aesd_buffer_entry *memory_entry(uint8_t index)
+{
+    return &memory_buffer.entry[(memory_buffer.out_offs + index) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+}
+
+/**
+ * @brief Adds the @param size bytes at @param packet, allocated with budget_malloc, as the
+ * newest packet
+ */
+static void memory_commit(char *packet, size_t size)
+{
+    struct aesd_buffer_entry entry;
+    char *evicted = NULL;
+    size_t evicted_size = 0;
+
+    entry.buffptr = packet;
+    entry.size = size;
+    entry.timestamp_ns = 0;
+    pthread_mutex_lock(&memory_mutex);
+    if (memory_buffer.full)
+    {
+        evicted_size = memory_buffer.entry[memory_buffer.in_offs].size;
+    }
+    evicted = (char *)aesd_circular_buffer_add_entry(&memory_buffer, &entry);
+    pthread_mutex_unlock(&memory_mutex);
+    budget_free(evicted, evicted_size);
+}
+
+static int memory_init(void)
+{
+    aesd_circular_buffer_init(&memory_buffer);
+    return SUCCESS;
+}
+
+static void memory_cleanup(void)
+{
+    uint8_t index = 0;
+
+    pthread_mutex_lock(&memory_mutex);
+    for (index = 0; index < aesd_circular_buffer_count(&memory_buffer); index++)
+    {
+        budget_free((char *)memory_entry(index)->buffptr, memory_entry(index)->size);
+    }
+    aesd_circular_buffer_init(&memory_buffer);
+    pthread_mutex_unlock(&memory_mutex);
+}
+
+static backend_conn_t *memory_open(void)
+{
+    return conn_alloc(-1);
+}
+
+static int memory_append(backend_conn_t *conn, const char *buf, size_t len)
+{
+    const char *packet = NULL;
+    size_t size = 0;
+    char *copy = NULL;
+
+    /* the packet is private to the connection until its new line arrives */
+    if (SUCCESS != conn_assemble(conn, buf, len, &packet, &size))
+    {
+        return FAILURE;
+    }
+    if (NULL == packet)
+    {
+        return SUCCESS;
+    }
+    if (packet == conn->pending)
+    {
+        /* the buffer takes over the assembled packet and its budget charge */
+        memory_commit(conn->pending, size);
+        conn->pending = NULL;
+        conn->pending_size = 0;
+        return SUCCESS;
+    }
+    copy = budget_malloc(size);
+    if (NULL == copy)
+    {
+        return FAILURE;
+    }
+    memcpy(copy, packet, size);
+    memory_commit(copy, size);
+    return SUCCESS;
+}
+
+static int memory_append_batch(backend_conn_t *conn, const struct iovec *records, size_t count)
+{
+    char *packet = NULL;
+    size_t index = 0;
+
+    for (index = 0; index < count; index++)
+    {
+        packet = budget_malloc(records[index].iov_len);
+        if (NULL == packet)
+        {
+            return FAILURE;
+        }
+        memcpy(packet, records[index].iov_base, records[index].iov_len);
+        memory_commit(packet, records[index].iov_len);
+    }
+    return SUCCESS;
+}
+
+static int memory_replay(backend_conn_t *conn, int connection_fd, backend_chunk_fn chunk)
+{
+    struct iovec iov[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    size_t iov_count = 0;
+    size_t total_size = 0;
+    size_t copied = 0;
+    size_t index = 0;
+    char *copy = NULL;
+    int status = SUCCESS;
+
+    /* copy the contents out so a slow client never holds memory_mutex */
+    pthread_mutex_lock(&memory_mutex);
+    iov_count = aesd_circular_buffer_fill_iovec(&memory_buffer, conn->pos, iov,
+                                                AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &total_size);
+    if (total_size > 0)
+    {
+        copy = budget_malloc(total_size);
+        if (NULL == copy)
+        {
+            pthread_mutex_unlock(&memory_mutex);
+            return FAILURE;
+        }
+    }
+    for (index = 0; index < iov_count; index++)
+    {
+        memcpy(copy + copied, iov[index].iov_base, iov[index].iov_len);
+        copied += iov[index].iov_len;
+    }
+    conn->pos += total_size;
+    pthread_mutex_unlock(&memory_mutex);
+
+    if ((total_size > 0) && (NULL != chunk))
+    {
+        status = chunk(connection_fd, total_size);
+    }
+    if (SUCCESS == status)
+    {
+        status = send_all(connection_fd, copy, total_size);
+    }
+    budget_free(copy, total_size);
+    return status;
+}
+
+static int memory_seek(backend_conn_t *conn, uint32_t write_cmd, uint32_t write_cmd_offset)
+{
+    size_t entry_start = 0;
+    uint8_t index = 0;
+    int status = FAILURE;
+
+    pthread_mutex_lock(&memory_mutex);
+    if ((write_cmd < aesd_circular_buffer_count(&memory_buffer)) &&
+        (write_cmd_offset < memory_entry(write_cmd)->size))
+    {
+        for (index = 0; index < write_cmd; index++)
+        {
+            entry_start += memory_entry(index)->size;
+        }
+        conn->pos = entry_start + write_cmd_offset;
+        status = SUCCESS;
+    }
+    pthread_mutex_unlock(&memory_mutex);
+    if (SUCCESS != status)
+    {
+        syslog(LOG_ERR, "seek to %u,%u: out of range", write_cmd, write_cmd_offset);
+    }
+    return status;
+}
+
+static int memory_rewind(backend_conn_t *conn)
+{
+    pthread_mutex_lock(&memory_mutex);
+    conn->pos = 0;
+    pthread_mutex_unlock(&memory_mutex);
+    return SUCCESS;
+}
+
+static int memory_tail(backend_conn_t *conn, uint32_t count)
+{
+    uint8_t entry_count = 0;
+    uint8_t index = 0;
+
+    pthread_mutex_lock(&memory_mutex);
+    entry_count = aesd_circular_buffer_count(&memory_buffer);
+    conn->pos = 0;
+    for (index = 0; (count < entry_count) && (index < entry_count - count); index++)
+    {
+        conn->pos += memory_entry(index)->size;
+    }
+    pthread_mutex_unlock(&memory_mutex);
+    return SUCCESS;
+}
+
+static void memory_close(backend_conn_t *conn)
+{
+    /* an unterminated packet is dropped with its connection */
+    conn_free(conn);
+}
+
+static const backend_t backends[] = {
+    {
+        .name = "file",
+        .timestamps = true,
+        .cleanup = file_cleanup,
+        .open = file_open,
+        .append = file_append,
+        .append_batch = file_append_batch,
+        .replay = file_replay,
+        .close = fd_close,
+    },
+    {
+        .name = "chardev",
+        .open = chardev_open,
+        .append = chardev_append,
+        .append_batch = chardev_append_batch,
+        .replay = chardev_replay,
+        .seek = chardev_seek,
+        .rewind = chardev_rewind,
+        .tail = chardev_tail,
+        .close = fd_close,
+    },
+    {
+        .name = "memory",
+        .init = memory_init,
+        .cleanup = memory_cleanup,
+        .open = memory_open,
+        .append = memory_append,
+        .append_batch = memory_append_batch,
+        .replay = memory_replay,
+        .seek = memory_seek,
+        .rewind = memory_rewind,
+        .tail = memory_tail,
+        .close = memory_close,
+    },
+};
+
+const backend_t *backend_find(const char *name)
+{
+    size_t index = 0;
+
+    for (index = 0; index < sizeof(backends) / sizeof(backends[0]); index++)
+    {
+        if (0 == strcmp(backends[index].name, name))
+        {
+            return &backends[index];
+        }
+    }
+    return NULL;
+}
+
+const char *backend_names(void)
+{
+    return "file|chardev|memory";
+}
@@ -0,0 +1,93 @@
+/**
+ * @file aesdsocket-backend.h
+ * @brief Storage backends of aesdsocket, selected at run time with -b.
+ *
+ * A backend stores the packets received by aesdsocket and replays its contents to clients.
+ * Each connection opens its own backend context, so backends with a per reader position
+ * (the char device and the memory ring) keep it per connection like an open file.
+ */
+
+#ifndef AESDSOCKET_BACKEND_H
+#define AESDSOCKET_BACKEND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Per connection state of a backend, defined by aesdsocket-backend.c */
+typedef struct backend_conn backend_conn_t;
+
+/* Called by replay before sending each chunk of @param len bytes, to frame the chunks */
+typedef int (*backend_chunk_fn)(int connection_fd, size_t len);
+
+typedef struct backend {
+    /**
+     * Name given to -b
+     */
+    const char *name;
+    /**
+     * Set when aesdsocket should append a timestamp line every TIMER_DELAY_PERIOD seconds
+     */
+    bool timestamps;
+    /**
+     * Prepares the backend once before connections are accepted, may be NULL
+     */
+    int (*init)(void);
+    /**
+     * Releases the backend storage when aesdsocket exits, may be NULL
+     */
+    void (*cleanup)(void);
+    /**
+     * Returns a new connection context, or NULL on failure
+     */
+    backend_conn_t *(*open)(void);
+    /**
+     * Appends @param len bytes, a packet is stored once a new line has been appended.  Bytes
+     * of an unterminated packet stay with the connection and are dropped by close.
+     */
+    int (*append)(backend_conn_t *conn, const char *buf, size_t len);
+    /**
+     * Stores each of the @param count records as one packet as is, whether or not it ends
+     * with a new line.  NULL if the backend has no batch support, records are then appended
+     * one by one.
+     */
+    int (*append_batch)(backend_conn_t *conn, const struct iovec *records, size_t count);
+    /**
+     * Sends the contents from the connection position to the end to @param connection_fd,
+     * announcing every chunk to @param chunk first unless it is NULL
+     */
+    int (*replay)(backend_conn_t *conn, int connection_fd, backend_chunk_fn chunk);
+    /**
+     * Moves the connection position to byte @param write_cmd_offset of packet @param write_cmd,
+     * counted from the oldest packet kept.  NULL if the backend cannot seek, in which case
+     * seek commands are stored as data.
+     */
+    int (*seek)(backend_conn_t *conn, uint32_t write_cmd, uint32_t write_cmd_offset);
+    /**
+     * Moves the connection position back to the oldest byte kept.  NULL if replay always
+     * starts there.
+     */
+    int (*rewind)(backend_conn_t *conn);
+    /**
+     * Moves the connection position to the start of the @param count newest packets, or of
+     * the oldest one if fewer are kept.  NULL if the backend cannot seek.
+     */
+    int (*tail)(backend_conn_t *conn, uint32_t count);
+    /**
+     * Releases a connection context returned by open, dropping an unterminated packet
+     */
+    void (*close)(backend_conn_t *conn);
+} backend_t;
+
+/**
+ * @brief Returns the backend called @param name, or NULL if there is none
+ */
+extern const backend_t *backend_find(const char *name);
+
+/**
+ * @brief Returns the backend names, separated by '|', for usage messages
+ */
+extern const char *backend_names(void);
+
+#endif /* AESDSOCKET_BACKEND_H */
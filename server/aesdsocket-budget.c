@@ -0,0 +1,61 @@
+/**
+ * @file aesdsocket-budget.c
+ * @brief Memory accounting of aesdsocket, see aesdsocket-budget.h.
+ *
+ * Connection threads charge their buffers as they grow while the main thread reads the total,
+ * so the counter is a single atomic and never needs a lock.
+ */
+
+/* Header files */
+#include <stdatomic.h>
+
+#include "aesdsocket-budget.h"
+
+/* Global definitions */
+static atomic_size_t budget_bytes;
+/* set once by the main thread before any connection thread starts */
+static size_t budget_limit_bytes = 0;
+
+/* Function definitions */
+
+void budget_charge(ssize_t bytes)
+{
+    /* unsigned wrap around turns a negative charge into a release */
+    atomic_fetch_add_explicit(&budget_bytes, (size_t)bytes, memory_order_relaxed);
+}
+
+size_t budget_used(void)
+{
+    return atomic_load_explicit(&budget_bytes, memory_order_relaxed);
+}
+
+void budget_set_limit(size_t limit)
+{
+    budget_limit_bytes = limit;
+}
+
+size_t budget_limit(void)
+{
+    return budget_limit_bytes;
+}
+
+bool budget_reserve(size_t bytes)
+{
+    size_t used = atomic_load_explicit(&budget_bytes, memory_order_relaxed);
+
+    if (0 == budget_limit_bytes)
+    {
+        budget_charge((ssize_t)bytes);
+        return true;
+    }
+    /* threads reserving at once must not both take the last bytes */
+    do
+    {
+        if ((used > budget_limit_bytes) || (bytes > budget_limit_bytes - used))
+        {
+            return false;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&budget_bytes, &used, used + bytes,
+                                                    memory_order_relaxed, memory_order_relaxed));
+    return true;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file aesdsocket-budget.h
+ * @brief Accounts for the memory aesdsocket spends on its connections.
+ *
+ * Connection and backend contexts, thread stacks, receive, payload and replay buffers, packets
+ * being assembled and the packets the memory backend stores are charged when they are allocated
+ * and credited when they are released, so the main thread can stop accepting
+ * connections once the total reaches the budget given with -m.  Buffers a connection grows
+ * while it runs are reserved with budget_reserve, which fails the growth instead of going
+ * over the budget.
+ */
+
+#ifndef AESDSOCKET_BUDGET_H
+#define AESDSOCKET_BUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * @brief Adds @param bytes to the memory in use, a negative value releases them
+ */
+extern void budget_charge(ssize_t bytes);
+
+/**
+ * @brief Returns the memory in use in bytes
+ */
+extern size_t budget_used(void);
+
+/**
+ * @brief Sets the budget to @param limit bytes, 0 for no limit
+ */
+extern void budget_set_limit(size_t limit);
+
+/**
+ * @brief Returns the budget in bytes, 0 for no limit
+ */
+extern size_t budget_limit(void);
+
+/**
+ * @brief Charges @param bytes unless the memory in use would go over the budget
+ *
+ * @return bool - true when the bytes were charged, release them with a negative budget_charge.
+ */
+extern bool budget_reserve(size_t bytes);
+
+#endif /* AESDSOCKET_BUDGET_H */
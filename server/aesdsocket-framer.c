@@ -0,0 +1,187 @@
+/**
+ * @file aesdsocket-framer.c
+ * @brief New line framing of the aesdsocket byte stream.
+ *
+ * The new line search compares 16 bytes at a time with SSE2 on x86 and NEON on arm64, and
+ * falls back to memchr elsewhere.  Every byte is scanned once, however the record is split
+ * across receives.
+ */
+
+/* Header files */
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "aesdsocket-budget.h"
+#include "aesdsocket-framer.h"
+
+/* Macro definitions */
+
+/* smallest buffer, and the least room framer_space tries to offer */
+#define FRAMER_MIN_SPACE   (1024)
+#define FRAMER_VECTOR_LEN  (16)
+
+/* Function definitions */
+
+/**
+ * @brief Returns the first new line in the @param len bytes at @param data, or NULL
+ */
+static const char *find_newline(const char *data, size_t len)
+{
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    int mask = 0;
+
+    while (len >= FRAMER_VECTOR_LEN)
+    {
+        mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)data), newline));
+        if (0 != mask)
+        {
+            return data + __builtin_ctz(mask);
+        }
+        data += FRAMER_VECTOR_LEN;
+        len -= FRAMER_VECTOR_LEN;
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    const uint8x16_t newline = vdupq_n_u8('\n');
+
+    while (len >= FRAMER_VECTOR_LEN)
+    {
+        if (0 != vmaxvq_u8(vceqq_u8(vld1q_u8((const uint8_t *)data), newline)))
+        {
+            /* locate it within the matching block */
+            break;
+        }
+        data += FRAMER_VECTOR_LEN;
+        len -= FRAMER_VECTOR_LEN;
+    }
+#endif
+    return memchr(data, '\n', len);
+}
+
+void framer_init(framer_t *framer, size_t max_record_len)
+{
+    memset(framer, 0, sizeof(*framer));
+    framer->max_record_len = max_record_len;
+}
+
+void framer_free(framer_t *framer)
+{
+    budget_charge(-(ssize_t)framer->capacity);
+    free(framer->data);
+    framer_init(framer, framer->max_record_len);
+}
+
+void framer_adopt(framer_t *framer, char *data, size_t capacity)
+{
+    framer_init(framer, framer->max_record_len);
+    framer->data = data;
+    framer->capacity = capacity;
+}
+
+char *framer_release(framer_t *framer, size_t *capacity_rtn)
+{
+    char *data = framer->data;
+
+    *capacity_rtn = framer->capacity;
+    framer_init(framer, framer->max_record_len);
+    return data;
+}
+
+char *framer_space(framer_t *framer, size_t *space_rtn)
+{
+    size_t needed = 0;
+    size_t capacity = (0 == framer->capacity) ? FRAMER_MIN_SPACE : framer->capacity;
+    char *data = NULL;
+
+    /* records before start were handed out, keep only the tail */
+    if (framer->start > 0)
+    {
+        memmove(framer->data, framer->data + framer->start, framer->size - framer->start);
+        framer->size -= framer->start;
+        framer->start = 0;
+    }
+
+    needed = framer->size + FRAMER_MIN_SPACE;
+    if (needed > framer->max_record_len)
+    {
+        needed = framer->max_record_len;
+    }
+    if (needed > framer->capacity)
+    {
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        if (capacity > framer->max_record_len)
+        {
+            capacity = framer->max_record_len;
+        }
+        if (!budget_reserve(capacity - framer->capacity))
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        data = realloc(framer->data, capacity);
+        if (NULL == data)
+        {
+            budget_charge(-(ssize_t)(capacity - framer->capacity));
+            return NULL;
+        }
+        framer->data = data;
+        framer->capacity = capacity;
+    }
+    *space_rtn = framer->capacity - framer->size;
+    return framer->data + framer->size;
+}
+
+void framer_received(framer_t *framer, size_t len)
+{
+    framer->size += len;
+}
+
+bool framer_next(framer_t *framer, framer_record_t *record)
+{
+    const char *tail = framer->data + framer->start;
+    const char *newline = find_newline(tail + framer->scanned,
+                                       framer->size - framer->start - framer->scanned);
+
+    if (NULL == newline)
+    {
+        framer->scanned = framer->size - framer->start;
+        return false;
+    }
+    record->data = tail;
+    record->len = newline - tail + 1;
+    record->continued = framer->continued;
+    framer->start += record->len;
+    framer->scanned = 0;
+    framer->continued = false;
+    return true;
+}
+
+bool framer_take_partial(framer_t *framer, framer_record_t *record)
+{
+    if (framer->size - framer->start < framer->max_record_len)
+    {
+        return false;
+    }
+    record->data = framer->data + framer->start;
+    record->len = framer->size - framer->start;
+    record->continued = framer->continued;
+    framer->start = framer->size;
+    framer->scanned = 0;
+    framer->continued = true;
+    return true;
+}
+
+size_t framer_tail_len(const framer_t *framer)
+{
+    return framer->size - framer->start;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file aesdsocket-framer.h
+ * @brief Splits the byte stream of a connection into new line terminated records.
+ *
+ * The framer owns the receive buffer of a connection.  Data is received straight into the
+ * space returned by framer_space, then framer_next returns every complete record it holds.
+ * The unterminated tail stays in the buffer and is completed by the following receives.
+ * Buffer growth is reserved from the memory budget of aesdsocket-budget.h.
+ */
+
+#ifndef AESDSOCKET_FRAMER_H
+#define AESDSOCKET_FRAMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct framer {
+    /**
+     * Received bytes, data[start] up to data[size] are not returned as a record yet
+     */
+    char *data;
+    size_t size;
+    size_t capacity;
+    size_t start;
+    /**
+     * Number of bytes after start already known to hold no new line
+     */
+    size_t scanned;
+    /**
+     * Longest tail kept, see framer_take_partial
+     */
+    size_t max_record_len;
+    /**
+     * Set when the beginning of the tail was already returned by framer_take_partial
+     */
+    bool continued;
+} framer_t;
+
+typedef struct framer_record {
+    /**
+     * Record bytes including its new line, valid until the next framer_space call
+     */
+    const char *data;
+    size_t len;
+    /**
+     * Set when these bytes end a record whose beginning was returned before
+     */
+    bool continued;
+} framer_record_t;
+
+/**
+ * @brief Initializes an empty framer keeping tails of at most @param max_record_len bytes
+ */
+extern void framer_init(framer_t *framer, size_t max_record_len);
+
+/**
+ * @brief Releases the buffer of @param framer
+ */
+extern void framer_free(framer_t *framer);
+
+/**
+ * @brief Hands the @param capacity bytes buffer @param data to an empty @param framer without a
+ * buffer, so a new connection reuses the buffer of a finished one
+ */
+extern void framer_adopt(framer_t *framer, char *data, size_t capacity);
+
+/**
+ * @brief Takes the buffer of @param framer, which is left empty without a buffer, and stores its
+ * size in @param capacity_rtn.  Returns NULL if the framer had no buffer.
+ */
+extern char *framer_release(framer_t *framer, size_t *capacity_rtn);
+
+/**
+ * @brief Returns where the next received bytes go and stores the room available in
+ * @param space_rtn.  Moves the tail to the start of the buffer and grows it geometrically,
+ * never beyond max_record_len bytes.  Returns NULL on allocation failure, with errno ENOMEM
+ * when the growth would exceed the memory budget, and sets @param space_rtn to 0 when the tail is full and framer_take_partial must be called.
+ */
+extern char *framer_space(framer_t *framer, size_t *space_rtn);
+
+/**
+ * @brief Accounts for @param len bytes received into the space returned by framer_space
+ */
+extern void framer_received(framer_t *framer, size_t len);
+
+/**
+ * @brief Returns the next complete record in @param record, false when only a tail is left
+ */
+extern bool framer_next(framer_t *framer, framer_record_t *record);
+
+/**
+ * @brief Returns the tail in @param record when it reached max_record_len bytes without a new
+ * line, so an overlong record can be handed over in pieces or dropped.  The rest of the record
+ * is then returned with continued set.
+ */
+extern bool framer_take_partial(framer_t *framer, framer_record_t *record);
+
+/**
+ * @brief Returns the number of bytes held after the last complete record
+ */
+extern size_t framer_tail_len(const framer_t *framer);
+
+#endif /* AESDSOCKET_FRAMER_H */
@@ -0,0 +1,308 @@
+/**
+ * @file aesdsocket-proto.c
+ * @brief Server side of the binary protocol described in aesdsocket-proto.h.
+ *
+ * Headers and payloads are received with their exact sizes, and records are handed to the
+ * backend where they lie in the payload buffer, so no byte is scanned or copied on the way.
+ */
+
+/* Header files */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/socket.h>
+
+#include "aesdsocket-budget.h"
+#include "aesdsocket-proto.h"
+
+/* Macro definitions */
+
+#define SUCCESS      (0)
+#define FAILURE      (-1)
+
+/* Function definitions */
+
+/**
+ * @brief Sends @param len bytes of @param buf, with @param flags, to @param connection_fd
+ */
+static int proto_send(int connection_fd, const void *buf, size_t len, int flags)
+{
+    const char *data = buf;
+    ssize_t send_bytes = 0;
+
+    while (len > 0)
+    {
+        send_bytes = send(connection_fd, data, len, flags);
+        if (send_bytes <= 0)
+        {
+            syslog(LOG_PERROR, "send: %s", strerror(errno));
+            return FAILURE;
+        }
+        data += send_bytes;
+        len -= send_bytes;
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Receives exactly @param len bytes into @param buf.  Returns 0 if the client closed
+ * the connection before the first byte, 1 once all bytes arrived, FAILURE otherwise.
+ */
+static int proto_recv(int connection_fd, void *buf, size_t len)
+{
+    ssize_t recv_bytes = recv(connection_fd, buf, len, MSG_WAITALL);
+
+    if (0 == recv_bytes)
+    {
+        return 0;
+    }
+    if (recv_bytes != len)
+    {
+        syslog(LOG_PERROR, "recv: %s", (recv_bytes < 0) ? strerror(errno) : "truncated message");
+        return FAILURE;
+    }
+    return 1;
+}
+
+static int proto_send_header(int connection_fd, uint32_t length, uint8_t opcode, uint8_t status,
+                             uint16_t count)
+{
+    struct aesd_proto_header header;
+
+    header.length = htonl(length);
+    header.opcode = opcode;
+    header.status = status;
+    header.count = htons(count);
+    return proto_send(connection_fd, &header, sizeof(header),
+                      (AESD_PROTO_DATA == opcode) ? MSG_MORE : 0);
+}
+
+/**
+ * @brief backend_chunk_fn framing replayed contents as AESD_PROTO_DATA messages
+ */
+static int proto_send_data_header(int connection_fd, size_t len)
+{
+    return proto_send_header(connection_fd, len, AESD_PROTO_DATA, 0, 0);
+}
+
+/**
+ * @brief Stores the @param count records of an APPEND payload, returns 0 or an errno value
+ */
+static int proto_append(const backend_t *backend, backend_conn_t *conn, const char *payload,
+                        size_t length, uint16_t count)
+{
+    struct iovec *records = NULL;
+    uint32_t record_len = 0;
+    size_t offset = 0;
+    size_t index = 0;
+    int error = 0;
+
+    records = malloc(count * sizeof(*records));
+    if ((NULL == records) && (count > 0))
+    {
+        return ENOMEM;
+    }
+    for (index = 0; index < count; index++)
+    {
+        if (length - offset < sizeof(record_len))
+        {
+            error = EINVAL;
+            goto exit;
+        }
+        memcpy(&record_len, payload + offset, sizeof(record_len));
+        record_len = ntohl(record_len);
+        offset += sizeof(record_len);
+        if ((0 == record_len) || (length - offset < record_len))
+        {
+            error = EINVAL;
+            goto exit;
+        }
+        records[index].iov_base = (void *)(payload + offset);
+        records[index].iov_len = record_len;
+        offset += record_len;
+    }
+    if (offset != length)
+    {
+        error = EINVAL;
+        goto exit;
+    }
+
+    if (NULL != backend->append_batch)
+    {
+        error = (SUCCESS == backend->append_batch(conn, records, count)) ? 0 : EIO;
+    }
+    else
+    {
+        for (index = 0; (index < count) && (0 == error); index++)
+        {
+            if (SUCCESS != backend->append(conn, records[index].iov_base, records[index].iov_len))
+            {
+                error = EIO;
+            }
+        }
+    }
+exit:
+    free(records);
+    return error;
+}
+
+/**
+ * @brief Moves the position of @param conn for a REPLAY, SEEK or TAIL request, returns 0 or an
+ * errno value
+ */
+static int proto_position(const backend_t *backend, backend_conn_t *conn,
+                          const struct aesd_proto_header *header, const char *payload)
+{
+    struct aesd_proto_seek seek;
+
+    switch (header->opcode)
+    {
+        case AESD_PROTO_REPLAY:
+        if ((NULL != backend->rewind) && (SUCCESS != backend->rewind(conn)))
+        {
+            return EIO;
+        }
+        return 0;
+
+        case AESD_PROTO_SEEK:
+        if (sizeof(seek) != header->length)
+        {
+            return EINVAL;
+        }
+        if (NULL == backend->seek)
+        {
+            return EOPNOTSUPP;
+        }
+        memcpy(&seek, payload, sizeof(seek));
+        /* out of range, unlike EINVAL this keeps the connection */
+        return (SUCCESS == backend->seek(conn, ntohl(seek.write_cmd), ntohl(seek.write_cmd_offset))) ?
+               0 : ERANGE;
+
+        case AESD_PROTO_TAIL:
+        if (NULL == backend->tail)
+        {
+            return EOPNOTSUPP;
+        }
+        return (SUCCESS == backend->tail(conn, header->count)) ? 0 : EIO;
+
+        default:
+        return EINVAL;
+    }
+}
+
+int proto_detect(int connection_fd)
+{
+    char magic[AESD_PROTO_MAGIC_LEN];
+    ssize_t recv_bytes = recv(connection_fd, magic, AESD_PROTO_MAGIC_LEN, MSG_PEEK);
+
+    if ((recv_bytes > 0) && (recv_bytes < AESD_PROTO_MAGIC_LEN) &&
+        (0 == memcmp(magic, AESD_PROTO_MAGIC, recv_bytes)))
+    {
+        /* the magic starts with a byte text clients never send, wait for the rest of it */
+        recv_bytes = recv(connection_fd, magic, AESD_PROTO_MAGIC_LEN, MSG_PEEK | MSG_WAITALL);
+    }
+    if (recv_bytes < 0)
+    {
+        syslog(LOG_PERROR, "recv: %s", strerror(errno));
+        return FAILURE;
+    }
+    if ((AESD_PROTO_MAGIC_LEN != recv_bytes) || (0 != memcmp(magic, AESD_PROTO_MAGIC, AESD_PROTO_MAGIC_LEN)))
+    {
+        return 0;
+    }
+    /* consume the magic and echo it to confirm the binary protocol */
+    if ((1 != proto_recv(connection_fd, magic, AESD_PROTO_MAGIC_LEN)) ||
+        (SUCCESS != proto_send(connection_fd, AESD_PROTO_MAGIC, AESD_PROTO_MAGIC_LEN, 0)))
+    {
+        return FAILURE;
+    }
+    return 1;
+}
+
+int proto_serve(const backend_t *backend, backend_conn_t *conn, int connection_fd,
+                proto_state_t *state)
+{
+    struct aesd_proto_header header;
+    uint16_t stored = 0;
+    int received = 0;
+    int error = 0;
+    int status = SUCCESS;
+
+    while (SUCCESS == status)
+    {
+        received = proto_recv(connection_fd, &header, sizeof(header));
+        if (1 != received)
+        {
+            status = (0 == received) ? SUCCESS : FAILURE;
+            break;
+        }
+        header.length = ntohl(header.length);
+        header.count = ntohs(header.count);
+        if (header.length > AESD_PROTO_MAX_PAYLOAD)
+        {
+            /* the stream cannot be resynchronized without reading the payload */
+            proto_send_header(connection_fd, 0, AESD_PROTO_DONE, EMSGSIZE, 0);
+            status = FAILURE;
+            break;
+        }
+        /* the payload buffer grows to the largest payload received */
+        if (header.length > state->payload_capacity)
+        {
+            budget_charge(-(ssize_t)state->payload_capacity);
+            free(state->payload);
+            state->payload = NULL;
+            state->payload_capacity = 0;
+            if (!budget_reserve(header.length))
+            {
+                syslog(LOG_ERR, "Memory budget exceeded by a payload of %u bytes", header.length);
+                proto_send_header(connection_fd, 0, AESD_PROTO_DONE, ENOMEM, 0);
+                status = FAILURE;
+                break;
+            }
+            state->payload = malloc(header.length);
+            if (NULL == state->payload)
+            {
+                budget_charge(-(ssize_t)header.length);
+                syslog(LOG_PERROR, "malloc: %s", strerror(errno));
+                status = FAILURE;
+                break;
+            }
+            state->payload_capacity = header.length;
+        }
+        if ((header.length > 0) && (1 != proto_recv(connection_fd, state->payload, header.length)))
+        {
+            status = FAILURE;
+            break;
+        }
+        state->bytes_received += sizeof(header) + header.length;
+
+        stored = 0;
+        if (AESD_PROTO_APPEND == header.opcode)
+        {
+            error = proto_append(backend, conn, state->payload, header.length, header.count);
+            stored = (0 == error) ? header.count : 0;
+            state->records += stored;
+        }
+        else
+        {
+            error = proto_position(backend, conn, &header, state->payload);
+            if ((0 == error) && (SUCCESS != backend->replay(conn, connection_fd, proto_send_data_header)))
+            {
+                status = FAILURE;
+                break;
+            }
+        }
+        if (SUCCESS != proto_send_header(connection_fd, 0, AESD_PROTO_DONE, error, stored))
+        {
+            status = FAILURE;
+        }
+        else if (EINVAL == error)
+        {
+            /* malformed request */
+            status = FAILURE;
+        }
+    }
+    return status;
+}
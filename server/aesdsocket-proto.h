@@ -0,0 +1,104 @@
+/**
+ * @file aesdsocket-proto.h
+ * @brief Length prefixed binary protocol of aesdsocket, for bulk ingestion by clients.
+ *
+ * A client selects the binary protocol by sending AESD_PROTO_MAGIC as the first bytes of a
+ * connection, which the server echoes.  Any other first byte keeps the new line delimited
+ * text protocol.  Every message then starts with a struct aesd_proto_header followed by
+ * length payload bytes, all integers in network byte order.  Records may hold any bytes,
+ * new lines included.
+ *
+ * Requests and their replies:
+ *   AESD_PROTO_APPEND  payload: count records, each a uint32_t length and its bytes.  Each
+ *                      record is stored as one packet.  Reply: DONE with the count stored.
+ *   AESD_PROTO_REPLAY  no payload.  Reply: the contents from the oldest packet.
+ *   AESD_PROTO_SEEK    payload: struct aesd_proto_seek.  Reply: the contents from that position.
+ *   AESD_PROTO_TAIL    no payload.  Reply: the contents of the count newest packets.
+ * Contents are sent as zero or more AESD_PROTO_DATA messages ended by AESD_PROTO_DONE.
+ * A DONE status other than zero is an errno value, after a malformed message the server
+ * closes the connection.
+ */
+
+#ifndef AESDSOCKET_PROTO_H
+#define AESDSOCKET_PROTO_H
+
+#include <stdint.h>
+
+#include "aesdsocket-backend.h"
+
+#define AESD_PROTO_MAGIC        "\0AB1"
+#define AESD_PROTO_MAGIC_LEN    (4)
+/* largest payload of a request */
+#define AESD_PROTO_MAX_PAYLOAD  (1024 * 1024)
+
+enum aesd_proto_opcode {
+    AESD_PROTO_APPEND = 1,
+    AESD_PROTO_REPLAY = 2,
+    AESD_PROTO_SEEK = 3,
+    AESD_PROTO_TAIL = 4,
+    AESD_PROTO_DATA = 0x80,
+    AESD_PROTO_DONE = 0x81,
+};
+
+struct aesd_proto_header {
+    /**
+     * The number of payload bytes following the header
+     */
+    uint32_t length;
+    /**
+     * One of enum aesd_proto_opcode
+     */
+    uint8_t opcode;
+    /**
+     * Zero in requests, zero or an errno value in AESD_PROTO_DONE
+     */
+    uint8_t status;
+    /**
+     * Records of an APPEND, packets of a TAIL, records stored for DONE, otherwise zero
+     */
+    uint16_t count;
+};
+
+/**
+ * Payload of AESD_PROTO_SEEK, the arguments of AESDCHAR_IOCSEEKTO
+ */
+struct aesd_proto_seek {
+    uint32_t write_cmd;
+    uint32_t write_cmd_offset;
+};
+
+/**
+ * Binary protocol state of a connection.  The payload buffer is reserved from the memory budget,
+ * a request it cannot grow for fails with ENOMEM, and goes back to its spare pool with the
+ * connection.
+ */
+typedef struct proto_state {
+    /**
+     * Payload buffer, grown to the largest payload received
+     */
+    char *payload;
+    size_t payload_capacity;
+    /**
+     * Records stored and bytes received by the connection
+     */
+    uint64_t records;
+    uint64_t bytes_received;
+} proto_state_t;
+
+/**
+ * @brief Returns 1 and consumes the magic if the client on @param connection_fd selected the
+ * binary protocol, 0 for the text protocol or a closed connection, -1 on error
+ */
+extern int proto_detect(int connection_fd);
+
+/**
+ * @brief Serves binary protocol requests from @param connection_fd with @param backend and its
+ * connection context @param conn until the client closes the connection, using and updating
+ * @param state
+ *
+ * @return int - 0 when the client closed the connection, -1 on error
+ */
+extern int proto_serve(const backend_t *backend, backend_conn_t *conn, int connection_fd,
+                       proto_state_t *state);
+
+#endif /* AESDSOCKET_PROTO_H */
@@ -37,44 +37,103 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <pthread.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <time.h>
 #include "queue.h"
-
-#include "../aesd-char-driver/aesd_ioctl.h"
+#include "aesdsocket-backend.h"
+#include "aesdsocket-budget.h"
+#include "aesdsocket-framer.h"
+#include "aesdsocket-proto.h"
 
 /* Macro definitions */
 
-#define ARG_COUNT    (2)
 #define SUCCESS      (0)
 #define FAILURE      (-1)
 #define ERROR        (-1)
 #define PORT         "9000"
-#define MAX_CONNECTIONS_ALLOWED   (10)
+/* clients wait in the backlog while accepting is paused by the memory budget */
+#define MAX_CONNECTIONS_ALLOWED   (SOMAXCONN)
 
+/* selects the default backend, -b overrides it */
 #define USE_AESD_CHAR_DEVICE   (1)
 
 #if (USE_AESD_CHAR_DEVICE == 0)
-    #define FILENAME      "/var/tmp/aesdsocketdata"
+    #define DEFAULT_BACKEND   "file"
 #elif (USE_AESD_CHAR_DEVICE == 1)
-    #define FILENAME      "/dev/aesdchar"
+    #define DEFAULT_BACKEND   "chardev"
 #endif
 
 #define MAX_BUFF_LEN   (1024)
 #define TIMER_DELAY_PERIOD   (10)
 #define MATCHED_INPUTS_COUNT      (2)
+/* largest packet assembled in memory, longer packets are dropped */
+#define MAX_PACKET_LEN   (1024 * 1024)
+#define SEEK_COMMAND     "AESDCHAR_IOCSEEKTO:"
+#define MAX_COMMAND_LEN  (64)
+/* connection contexts preallocated unless -c says otherwise */
+#define DEFAULT_CONNECTION_POOL_SIZE   (128)
+/* buffers up to this size go back to their spare pool, larger ones are freed */
+#define POOL_KEEP_BUFFER_LEN   (64 * 1024)
+/* most buffers kept in each spare pool */
+#define SPARE_BUFFER_COUNT   (64)
+#define CACHE_LINE_SIZE   (64)
+/* thread stack size unless -s says otherwise, the handlers need a few KB */
+#define DEFAULT_THREAD_STACK_SIZE   (64 * 1024)
+/* how long accepting pauses before the memory budget is checked again */
+#define BUDGET_WAIT_NS   (10 * 1000 * 1000)
 
 /* Global definitions */
 static volatile sig_atomic_t exit_condition = 0;
 static int socket_fd = 0;
-static char ClientIpAddr[INET_ADDRSTRLEN];
+static const backend_t *backend = NULL;
 
+/* Context of the timer thread or of one connection, taken from node_pool */
 typedef struct socket_node {
     pthread_t thread_id;
     int connection_fd;
     bool thread_complete_success;
-    pthread_mutex_t *thread_mutex;
+    /* set by the thread when it is done, successful or not */
+    atomic_bool thread_complete;
+    char peer_addr[INET_ADDRSTRLEN];
+    framer_t framer;
+    proto_state_t proto;
+    /* records stored and bytes received from the text protocol */
+    uint64_t records;
+    uint64_t bytes_received;
+    /* links the node in the list of running threads or in the free list */
     SLIST_ENTRY(socket_node) node_count;
-}socket_node_t;
+} __attribute__((aligned(CACHE_LINE_SIZE))) socket_node_t;
+
+SLIST_HEAD(socket_head, socket_node);
+
+/* preallocated contexts, only the main thread takes and returns them */
+static socket_node_t *node_pool = NULL;
+static size_t node_pool_size = 0;
+static SLIST_HEAD(socket_free_list, socket_node) free_nodes;
+
+/* Buffer of a finished connection, kept for the next one */
+typedef struct spare_buffer {
+    char *data;
+    size_t capacity;
+} spare_buffer_t;
+
+/* Buffers of one kind kept for the next connections, used by the main thread only like the contexts */
+typedef struct spare_pool {
+    spare_buffer_t buffers[SPARE_BUFFER_COUNT];
+    size_t count;
+} spare_pool_t;
+
+/* receive buffers and binary protocol payload buffers never mix, a small payload buffer
+ * would make a poor receive buffer */
+static spare_pool_t framer_spares;
+static spare_pool_t payload_spares;
+
+/* attributes of every thread, with a stack of thread_stack_size bytes */
+static pthread_attr_t thread_attr;
+static size_t thread_stack_size = DEFAULT_THREAD_STACK_SIZE;
+/* set by -k, connections stay open until the client closes them */
+static bool keep_connections = false;
 
 /* Function Prototypes */
 static int start_daemon(void);
@@ -83,6 +142,249 @@ void signal_handler(int signo);
 void *recv_and_send_thread(void *thread_node);
 
 /* Function definitions */
+/**
+ * @brief Keeps @param data, a buffer of @param capacity bytes, in @param pool, or frees it
+ *        when it is too large or the pool is full.
+ *
+ * @return void
+ */
+static void spare_put(spare_pool_t *pool, char *data, size_t capacity)
+{
+    if (NULL == data)
+    {
+        return;
+    }
+    if ((capacity > POOL_KEEP_BUFFER_LEN) || (SPARE_BUFFER_COUNT == pool->count))
+    {
+        budget_charge(-(ssize_t)capacity);
+        free(data);
+        return;
+    }
+    pool->buffers[pool->count].data = data;
+    pool->buffers[pool->count].capacity = capacity;
+    pool->count++;
+}
+
+/**
+ * @brief Takes the most recently kept buffer of @param pool, it is likely still cached.
+ *
+ * @param capacity set to the size of the buffer.
+ *
+ * @return char * - the buffer, or NULL when the pool is empty.
+ */
+static char *spare_take(spare_pool_t *pool, size_t *capacity)
+{
+    if (0 == pool->count)
+    {
+        *capacity = 0;
+        return NULL;
+    }
+    pool->count--;
+    *capacity = pool->buffers[pool->count].capacity;
+    return pool->buffers[pool->count].data;
+}
+
+/**
+ * @brief Frees every buffer of @param pool.
+ *
+ * @return void
+ */
+static void spare_trim(spare_pool_t *pool)
+{
+    while (pool->count > 0)
+    {
+        pool->count--;
+        budget_charge(-(ssize_t)pool->buffers[pool->count].capacity);
+        free(pool->buffers[pool->count].data);
+    }
+}
+
+/**
+ * @brief Preallocates @param count contexts, cache line aligned so threads working on
+ *        neighbouring contexts never share a line.
+ *
+ * @return int - SUCCESS or FAILURE.
+ */
+static int pool_init(size_t count)
+{
+    size_t index = 0;
+
+    node_pool = aligned_alloc(CACHE_LINE_SIZE, count * sizeof(socket_node_t));
+    if (NULL == node_pool)
+    {
+        syslog(LOG_PERROR, "aligned_alloc: %s", strerror(errno));
+        return FAILURE;
+    }
+    memset(node_pool, 0, count * sizeof(socket_node_t));
+    node_pool_size = count;
+    budget_charge(count * sizeof(socket_node_t));
+    /* in reverse, so contexts are handed out in address order */
+    for (index = count; index > 0; index--)
+    {
+        framer_init(&node_pool[index - 1].framer, MAX_PACKET_LEN);
+        SLIST_INSERT_HEAD(&free_nodes, &node_pool[index - 1], node_count);
+    }
+    return SUCCESS;
+}
+
+/**
+ * @brief Takes a context from the free list, with a receive buffer and a payload buffer from
+ *        the spare pools if they hold one.
+ *
+ * @return socket_node_t * - the context, or NULL when all of them are in use.
+ */
+static socket_node_t *pool_get(void)
+{
+    socket_node_t *node = SLIST_FIRST(&free_nodes);
+    char *data = NULL;
+    size_t capacity = 0;
+
+    if (NULL != node)
+    {
+        SLIST_REMOVE_HEAD(&free_nodes, node_count);
+        node->connection_fd = -1;
+        node->thread_complete_success = false;
+        atomic_store(&node->thread_complete, false);
+        node->peer_addr[0] = '\0';
+        node->records = 0;
+        node->bytes_received = 0;
+        node->proto.records = 0;
+        node->proto.bytes_received = 0;
+        data = spare_take(&framer_spares, &capacity);
+        if (NULL != data)
+        {
+            framer_adopt(&node->framer, data, capacity);
+        }
+        node->proto.payload = spare_take(&payload_spares, &node->proto.payload_capacity);
+    }
+    return node;
+}
+
+/**
+ * @brief Returns a context whose thread was joined to the free list and its buffers to their
+ *        spare pools, so idle contexts hold no buffer.
+ *
+ * @param node context taken with pool_get.
+ *
+ * @return void
+ */
+static void pool_put(socket_node_t *node)
+{
+    char *data = NULL;
+    size_t capacity = 0;
+
+    data = framer_release(&node->framer, &capacity);
+    spare_put(&framer_spares, data, capacity);
+    spare_put(&payload_spares, node->proto.payload, node->proto.payload_capacity);
+    node->proto.payload = NULL;
+    node->proto.payload_capacity = 0;
+    /* most recently used first, it is likely still cached */
+    SLIST_INSERT_HEAD(&free_nodes, node, node_count);
+}
+
+/**
+ * @brief Releases the pool, the buffers of its contexts and the spare pools.
+ *
+ * @param void
+ *
+ * @return void
+ */
+static void pool_destroy(void)
+{
+    size_t index = 0;
+
+    for (index = 0; index < node_pool_size; index++)
+    {
+        framer_free(&node_pool[index].framer);
+        budget_charge(-(ssize_t)node_pool[index].proto.payload_capacity);
+        free(node_pool[index].proto.payload);
+    }
+    spare_trim(&framer_spares);
+    spare_trim(&payload_spares);
+    budget_charge(-(ssize_t)(node_pool_size * sizeof(socket_node_t)));
+    free(node_pool);
+    node_pool = NULL;
+    node_pool_size = 0;
+    SLIST_INIT(&free_nodes);
+}
+
+/**
+ * @brief Starts @param start_routine for @param node in a thread with the small stack of
+ *        thread_attr, charging the stack to the memory budget.
+ *
+ * @return int - SUCCESS or FAILURE.
+ */
+static int start_thread(socket_node_t *node, void *(*start_routine)(void *))
+{
+    int error = pthread_create(&node->thread_id, &thread_attr, start_routine, node);
+
+    if (SUCCESS != error)
+    {
+        syslog(LOG_PERROR, "pthread_create: %s", strerror(error));
+        return FAILURE;
+    }
+    budget_charge(thread_stack_size);
+    return SUCCESS;
+}
+
+/**
+ * @brief Joins the thread of @param node, closes its connection and returns the context to
+ *        the pool.
+ *
+ * @return void
+ */
+static void join_thread(socket_node_t *node)
+{
+    pthread_join(node->thread_id, NULL);
+    budget_charge(-(ssize_t)thread_stack_size);
+    if ((-1 != node->connection_fd) && (FAILURE == close(node->connection_fd)))
+    {
+        syslog(LOG_PERROR, "close: %s", strerror(errno));
+    }
+    pool_put(node);
+}
+
+/**
+ * @brief Joins the threads of @param head that are done and recycles their contexts.
+ *
+ * @return void
+ */
+static void reap_threads(struct socket_head *head)
+{
+    socket_node_t *node = NULL;
+    socket_node_t *node_temp = NULL;
+
+    SLIST_FOREACH_SAFE(node, head, node_count, node_temp)
+    {
+        if (atomic_load(&node->thread_complete))
+        {
+            SLIST_REMOVE(head, node, socket_node, node_count);
+            join_thread(node);
+        }
+    }
+}
+
+/**
+ * @brief Tells whether one more connection thread fits in the memory budget, after reaping
+ *        the threads of @param head that are done and trimming the shared buffer pool.
+ *
+ * @return bool
+ */
+static bool budget_allows_connection(struct socket_head *head)
+{
+    if ((0 == budget_limit()) || (budget_used() + thread_stack_size <= budget_limit()))
+    {
+        return true;
+    }
+    reap_threads(head);
+    if (budget_used() + thread_stack_size > budget_limit())
+    {
+        spare_trim(&framer_spares);
+        spare_trim(&payload_spares);
+    }
+    return (budget_used() + thread_stack_size <= budget_limit());
+}
+
 /**
  * @brief Starts Daemon by creating a child process
  *
@@ -161,13 +463,10 @@ static int start_daemon(void)
  */
 static void close_app(void)
 {
-#if (USE_AESD_CHAR_DEVICE == 0)
-    /* deletes the file */
-    if (FAILURE == unlink(FILENAME))
+    if ((NULL != backend) && (NULL != backend->cleanup))
     {
-       syslog(LOG_PERROR, "unlink %s: %s", FILENAME, strerror(errno));
+        backend->cleanup();
     }
-#endif
 
     if (FAILURE == shutdown(socket_fd, SHUT_RDWR))
     {
@@ -194,7 +493,6 @@ void signal_handler(int signo)
     }
 }
 
-#if (USE_AESD_CHAR_DEVICE == 0)
 /**
  * @brief Handles timer thread functionality by writing timestamp for every 10 secs.
  *
@@ -206,18 +504,23 @@ void *start_timer_thread(void *thread_node)
 {
     socket_node_t *node = NULL;
     int status = FAILURE;
-    int file_fd = -1;
+    backend_conn_t *conn = NULL;
     struct timespec time_period;
     char output[MAX_BUFF_LEN] = {'\0'};
     time_t curr_time;
     struct tm *temp;
-    int written_bytes = 0;
     if (NULL == thread_node)
     {
         return NULL;
     }
     node = (socket_node_t *)thread_node;
-    
+
+    conn = backend->open();
+    if (NULL == conn)
+    {
+        status = FAILURE;
+        goto exit;
+    }
     while (!exit_condition)
     {
         if (SUCCESS != clock_gettime(CLOCK_MONOTONIC, &time_period))
@@ -256,196 +559,249 @@ void *start_timer_thread(void *thread_node)
             status = FAILURE;
             goto exit;        
         }
-        /* open file in readwrite mode */
-        file_fd = open(FILENAME, O_CREAT|O_RDWR|O_APPEND, 
-                       S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
-        if (FAILURE == file_fd)
-        {
-            syslog(LOG_ERR, "Error opening %s file: %s", FILENAME, strerror(errno));
-            status = FAILURE;
-            goto exit;
-        }       
-        if (SUCCESS != pthread_mutex_lock(node->thread_mutex))
-        {
-            syslog(LOG_PERROR, "pthread_mutex_lock: %s", strerror(errno));
-            status = FAILURE;
-            goto exit;
-        }
-        /* write the timestamp to the file */
-        written_bytes = write(file_fd, output, strlen(output));
-        if (written_bytes != strlen(output))
+        /* write the timestamp to the backend */
+        if (SUCCESS != backend->append(conn, output, strlen(output)))
         {
-            syslog(LOG_ERR, "Error writing %s to %s file: %s", output, FILENAME,
-                       strerror(errno));
-            status = FAILURE;
-            pthread_mutex_unlock(node->thread_mutex);
-            goto exit;
-        }
-        if (SUCCESS != pthread_mutex_unlock(node->thread_mutex))
-        {
-            syslog(LOG_PERROR, "pthread_mutex_unlock: %s", strerror(errno));
             status = FAILURE;
             goto exit;
         }
         status = SUCCESS;
-        close(file_fd);
     }
 exit:
+     if (NULL != conn)
+     {
+         backend->close(conn);
+     }
      (status == FAILURE) ? (node->thread_complete_success = false) : 
                            (node->thread_complete_success = true);
+     atomic_store(&node->thread_complete, true);
      return thread_node;
 }
-#endif
+
+/**
+ * @brief Acknowledges the records appended so far by sending the backend contents from the
+ *        oldest packet.
+ *
+ * @param conn backend context of the connection.
+ * @param connection_fd socket to reply on.
+ *
+ * @return int - SUCCESS or FAILURE.
+ */
+static int replay_contents(backend_conn_t *conn, int connection_fd)
+{
+    if ((NULL != backend->rewind) && (SUCCESS != backend->rewind(conn)))
+    {
+        return FAILURE;
+    }
+    return backend->replay(conn, connection_fd, NULL);
+}
+
+/**
+ * @brief Stores one record received from a client, or moves the connection position for a
+ *        seek command and sends the backend contents from there.  Stored records are
+ *        acknowledged by the caller with one replay for the whole batch, or here before a seek
+ *        command so replies keep the order of the records.
+ *
+ * @param conn backend context of the connection.
+ * @param record new line terminated record.
+ * @param connection_fd socket to reply on.
+ * @param appended set once a record was stored, cleared once the records were acknowledged.
+ *
+ * @return int - SUCCESS or FAILURE.
+ */
+static int handle_record(backend_conn_t *conn, const framer_record_t *record, int connection_fd,
+                         bool *appended)
+{
+    char command[MAX_COMMAND_LEN];
+    size_t command_len = strlen(SEEK_COMMAND);
+    unsigned int write_cmd = 0;
+    unsigned int write_cmd_offset = 0;
+
+    /* seek commands are only understood by backends that can seek */
+    if ((NULL != backend->seek) && (record->len > command_len) &&
+        (SUCCESS == memcmp(record->data, SEEK_COMMAND, command_len)))
+    {
+        if ((*appended) && (SUCCESS != replay_contents(conn, connection_fd)))
+        {
+            return FAILURE;
+        }
+        *appended = false;
+        command_len = (record->len < MAX_COMMAND_LEN) ? record->len : (MAX_COMMAND_LEN - 1);
+        memcpy(command, record->data, command_len);
+        command[command_len] = '\0';
+        if (MATCHED_INPUTS_COUNT != sscanf(command, SEEK_COMMAND "%u,%u",
+                                           &write_cmd, &write_cmd_offset))
+        {
+            syslog(LOG_PERROR, "sscanf: %s", strerror(errno));
+        }
+        else
+        {
+            backend->seek(conn, write_cmd, write_cmd_offset);
+        }
+        /* send backend contents till the end */
+        return backend->replay(conn, connection_fd, NULL);
+    }
+    /* write the record to the backend with a single append */
+    if (SUCCESS != backend->append(conn, record->data, record->len))
+    {
+        return FAILURE;
+    }
+    *appended = true;
+    return SUCCESS;
+}
 
 /**
  * @brief Handles socket recv and send data.
  *
+ * Every new line terminated record is stored on its own, however the client batches records
+ * into segments.  The records framed from one recv are acknowledged together by sending the
+ * backend contents from the oldest packet once, a seek command gets its own reply.  As before,
+ * the connection is closed once the records received are answered and no unterminated tail is
+ * left, unless -k keeps connections open until the client closes them.  A record longer than
+ * MAX_PACKET_LEN and an unterminated tail left when the client closes the connection are
+ * dropped, nothing of them reaches the backend.  Clients starting with AESD_PROTO_MAGIC are
+ * served the binary protocol instead.
+ *
  * @param thread_node contains thread data.
  *
  * @return void *
  */
 void *recv_and_send_thread(void *thread_node)
 {
-    int recv_bytes = 0;
-    char buffer[MAX_BUFF_LEN] = {'\0'};
-    bool packet_complete = false;
-    int written_bytes = 0;
+    ssize_t recv_bytes = 0;
+    framer_t *framer = NULL;
+    framer_record_t record;
+    char *space = NULL;
+    size_t space_len = 0;
     socket_node_t *node = NULL;
     int status = FAILURE;
-    int file_fd = -1;
-#if (USE_AESD_CHAR_DEVICE == 1)
-    const char *ioctl_str = "AESDCHAR_IOCSEEKTO:";
-#endif
+    int binary = 0;
+    bool dropping = false;
+    bool appended = false;
+    bool terminated = false;
+    backend_conn_t *conn = NULL;
     if (NULL == thread_node)
     {
         return NULL;
     }
-    else
+    node = (socket_node_t *)thread_node;
+    framer = &node->framer;
+    conn = backend->open();
+    if (NULL == conn)
+    {
+        status = FAILURE;
+        goto exit;
+    }
+    binary = proto_detect(node->connection_fd);
+    if (FAILURE == binary)
+    {
+        status = FAILURE;
+        goto exit;
+    }
+    if (1 == binary)
     {
-        node = (socket_node_t *)thread_node;
-        /* open file in readwrite mode */
-        file_fd = open(FILENAME, O_CREAT|O_RDWR|O_APPEND, 
-                       S_IWUSR | S_IRUSR | S_IWGRP | S_IRGRP | S_IROTH);
-        if (FAILURE == file_fd)
+        status = proto_serve(backend, conn, node->connection_fd, &node->proto);
+        goto exit;
+    }
+
+    /* loop to receive data until the records are answered or the client closes the connection */
+    while (!exit_condition)
+    {
+        if (framer_take_partial(framer, &record))
+        {
+            /* too long to assemble, drop it up to its new line */
+            if (!record.continued)
+            {
+                syslog(LOG_WARNING, "Dropping a record longer than %d bytes from %s", MAX_PACKET_LEN,
+                       node->peer_addr);
+            }
+            dropping = true;
+        }
+        space = framer_space(framer, &space_len);
+        if (NULL == space)
         {
-            syslog(LOG_ERR, "Error opening %s file: %s", FILENAME, strerror(errno));
+            /* ENOMEM as well when the memory budget is used up, the connection is dropped */
+            syslog(LOG_PERROR, "Receive buffer of %s: %s", node->peer_addr, strerror(errno));
             status = FAILURE;
             goto exit;
         }
-
-        /* loop to receive data until new line is found */
-        do
+        /* recv data from client straight into the framer */
+        recv_bytes = recv(node->connection_fd, space, space_len, 0);
+        if (FAILURE == recv_bytes)
         {
-            memset(buffer, 0, MAX_BUFF_LEN);
-            /* recv data from client */
-            recv_bytes = recv(node->connection_fd, buffer, MAX_BUFF_LEN, 0);
-            if (FAILURE == recv_bytes)
-            {
-                syslog(LOG_PERROR, "recv: %s", strerror(errno));
-                status = FAILURE;
-                goto exit;
-            }
-#if (USE_AESD_CHAR_DEVICE == 1)
-            if (SUCCESS == strncmp(buffer, ioctl_str, strlen(ioctl_str)))
+            syslog(LOG_PERROR, "recv: %s", strerror(errno));
+            status = FAILURE;
+            goto exit;
+        }
+        if (0 == recv_bytes)
+        {
+            /* client closed the connection, an unterminated tail is dropped */
+            if ((0 != framer_tail_len(framer)) && (!dropping))
             {
-                struct aesd_seekto seek_info;
-                if (MATCHED_INPUTS_COUNT != sscanf(buffer, "AESDCHAR_IOCSEEKTO:%d,%d",
-                                                   &seek_info.write_cmd,
-                                                   &seek_info.write_cmd_offset))
-                {
-                    syslog(LOG_PERROR, "sscanf: %s", strerror(errno));
-                }
-                else
-                {
-                    if(SUCCESS != ioctl(file_fd, AESDCHAR_IOCSEEKTO, &seek_info))
-                    {
-                        syslog(LOG_PERROR, "ioctl: %s", strerror(errno));
-                    }
-                }
-                goto read_data;
+                syslog(LOG_INFO, "Dropping %zu unterminated bytes from %s", framer_tail_len(framer),
+                       node->peer_addr);
             }
-#endif
-            if (SUCCESS != pthread_mutex_lock(node->thread_mutex))
+            break;
+        }
+        framer_received(framer, recv_bytes);
+        node->bytes_received += recv_bytes;
+        terminated = false;
+        while (framer_next(framer, &record))
+        {
+            terminated = true;
+            if (record.continued)
             {
-                syslog(LOG_PERROR, "pthread_mutex_lock: %s", strerror(errno));
-                status = FAILURE;
-                goto exit;
+                /* the end of a dropped record */
+                dropping = false;
+                continue;
             }
-            /* write the string received to the file */
-            written_bytes = write(file_fd, buffer, recv_bytes);
-            if (written_bytes != recv_bytes)
+            if (SUCCESS != handle_record(conn, &record, node->connection_fd, &appended))
             {
-                syslog(LOG_ERR, "Error writing %s to %s file: %s", buffer, FILENAME,
-                       strerror(errno));
                 status = FAILURE;
-                pthread_mutex_unlock(node->thread_mutex);
                 goto exit;
             }
-            if (SUCCESS != pthread_mutex_unlock(node->thread_mutex))
+            node->records++;
+        }
+        /* one reply for every record stored from this recv */
+        if (appended)
+        {
+            if (SUCCESS != replay_contents(conn, node->connection_fd))
             {
-                syslog(LOG_PERROR, "pthread_mutex_unlock: %s", strerror(errno));
                 status = FAILURE;
                 goto exit;
             }
-            /* check for new line */
-            if (NULL != (memchr(buffer, '\n', recv_bytes)))
-            {
-                packet_complete = true;
-            }
-        } while (!packet_complete);
-
-        packet_complete = false;
-#if (USE_AESD_CHAR_DEVICE == 0)
-        close(file_fd);
-        /* open file in read mode */
-        file_fd = open(FILENAME, O_RDONLY, S_IRUSR | S_IRGRP | S_IROTH);
-        if (FAILURE == file_fd)
+            appended = false;
+        }
+        if ((!keep_connections) && terminated && (0 == framer_tail_len(framer)))
         {
-            syslog(LOG_ERR, "Error opening %s file: %s for read", FILENAME, strerror(errno));
-            status = FAILURE;
-            goto exit;
+            /* the client got its reply and sent nothing more */
+            break;
         }
-#endif
-        /* read file contents till EOF */
-        int read_bytes = 0;
-        int send_bytes = 0;
-read_data:
-       do
-        {
-            memset(buffer, 0, MAX_BUFF_LEN);
-            read_bytes = read(file_fd, buffer, MAX_BUFF_LEN);
-            if (read_bytes > 0)
-            {
-                /* send file data to client */
-                send_bytes = send(node->connection_fd, buffer, read_bytes, 0);
-                if (send_bytes != read_bytes)
-                {
-                    syslog(LOG_PERROR, "send: %s", strerror(errno));
-                    status = FAILURE;
-                    goto exit;
-                }
-                status = SUCCESS;
-            }
-        } while (read_bytes > 0);
     }
+    status = SUCCESS;
 exit:
-    if (file_fd != -1)
-    {
-        close(file_fd);
-    }
-    if (SUCCESS == close(node->connection_fd))
+    if (NULL != conn)
     {
-        syslog(LOG_INFO, "Closed connection from %s", ClientIpAddr);
+        backend->close(conn);
     }
+    /* the client sees the end of the connection now, the descriptor is closed once the thread
+     * is joined so the main thread never shuts down a descriptor reused by another connection */
+    shutdown(node->connection_fd, SHUT_RDWR);
+    syslog(LOG_INFO, "Closed connection from %s after %llu records, %llu bytes", node->peer_addr,
+           (unsigned long long)(node->records + node->proto.records),
+           (unsigned long long)(node->bytes_received + node->proto.bytes_received));
     (status == FAILURE) ? (node->thread_complete_success = false) : 
                            (node->thread_complete_success = true);
+    atomic_store(&node->thread_complete, true);
     return thread_node;
 }
 /**
  * @brief Main function to write a string to the file
  *
  * Creates socket and wait for client connections. Receives data from client and
- * write to a file when new line is found and sends back data to client.
+ * write to a file when new line is found and sends back data to client, see
+ * recv_and_send_thread.
+ * Usage: aesdsocket [-d] [-k] [-b file|chardev|memory] [-c connections] [-s stack KB] [-m budget MB]
  *
  * @param argc number of arguments
  *
@@ -461,19 +817,88 @@ int main(int argc, char* argv[])
     struct addrinfo *serverInfo = NULL;
     struct sockaddr_in clientAddr;
     socklen_t clientAddrLen = sizeof(struct sockaddr);
+    char peer_addr[INET_ADDRSTRLEN];
     
     const int enable_reuse = 1;
     socket_node_t *data_ptr = NULL;
-    socket_node_t *data_ptr_temp = NULL;
-    pthread_mutex_t thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+    const char *backend_name = DEFAULT_BACKEND;
+    long pool_size = DEFAULT_CONNECTION_POOL_SIZE;
+    long option_value = 0;
+    bool accept_paused = false;
+    const struct timespec budget_wait = {0, BUDGET_WAIT_NS};
+    int option = 0;
     /* opens a connection to syslog for writing the logs */
     openlog(NULL, 0, LOG_USER);
 
     /* check the arguments */
-    if ((ARG_COUNT == argc) && (strcmp(argv[1], "-d") == 0))
+    while (FAILURE != (option = getopt(argc, argv, "dkb:c:s:m:")))
     {
-        syslog(LOG_INFO, "Starting aesdsocket as a daemon");
-        start_as_daemon = true;
+        switch (option)
+        {
+            case 'd':
+            syslog(LOG_INFO, "Starting aesdsocket as a daemon");
+            start_as_daemon = true;
+            break;
+
+            case 'k':
+            keep_connections = true;
+            break;
+
+            case 'b':
+            backend_name = optarg;
+            break;
+
+            case 'c':
+            pool_size = strtol(optarg, NULL, 0);
+            if (pool_size <= 0)
+            {
+                fprintf(stderr, "Invalid connection count %s\n", optarg);
+                return FAILURE;
+            }
+            break;
+
+            case 's':
+            option_value = strtol(optarg, NULL, 0);
+            if (option_value <= 0)
+            {
+                fprintf(stderr, "Invalid stack size %s\n", optarg);
+                return FAILURE;
+            }
+            thread_stack_size = option_value * 1024;
+            break;
+
+            case 'm':
+            option_value = strtol(optarg, NULL, 0);
+            if (option_value <= 0)
+            {
+                fprintf(stderr, "Invalid memory budget %s\n", optarg);
+                return FAILURE;
+            }
+            budget_set_limit(option_value * 1024 * 1024);
+            break;
+
+            default:
+            fprintf(stderr, "Usage: %s [-d] [-k] [-b %s] [-c connections] [-s stack KB] [-m budget MB]\n",
+                    argv[0], backend_names());
+            return FAILURE;
+        }
+    }
+    backend = backend_find(backend_name);
+    if (NULL == backend)
+    {
+        fprintf(stderr, "Unknown backend %s, use one of %s\n", backend_name, backend_names());
+        return FAILURE;
+    }
+    syslog(LOG_INFO, "Using the %s backend", backend->name);
+    if (thread_stack_size < PTHREAD_STACK_MIN)
+    {
+        thread_stack_size = PTHREAD_STACK_MIN;
+    }
+    if ((SUCCESS != pthread_attr_init(&thread_attr)) ||
+        (SUCCESS != pthread_attr_setstacksize(&thread_attr, thread_stack_size)))
+    {
+        fprintf(stderr, "Invalid stack size %zu\n", thread_stack_size);
+        return FAILURE;
     }
     
     struct sigaction sa;
@@ -492,8 +917,14 @@ int main(int argc, char* argv[])
         syslog(LOG_PERROR, "sigaction SIGTERM: %s", strerror(errno));
         return FAILURE;
     }
+    /* a client closing during a reply fails the send with EPIPE instead of killing the server */
+    if (SIG_ERR == signal(SIGPIPE, SIG_IGN))
+    {
+        syslog(LOG_PERROR, "signal SIGPIPE: %s", strerror(errno));
+        return FAILURE;
+    }
     
-    SLIST_HEAD(socket_head, socket_node) head;
+    struct socket_head head;
     SLIST_INIT(&head);
     /* create socket */
     socket_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -564,33 +995,64 @@ int main(int argc, char* argv[])
         status = FAILURE;
         goto exit;
     }
-#if (USE_AESD_CHAR_DEVICE == 0)
-    /* create node for timer thread */
-    data_ptr = (socket_node_t *)malloc(sizeof(socket_node_t));
-    if (NULL == data_ptr)
+    if ((NULL != backend->init) && (SUCCESS != backend->init()))
     {
-        syslog(LOG_PERROR, "malloc: %s", strerror(errno));
+        syslog(LOG_ERR, "Initializing the %s backend failed", backend->name);
         status = FAILURE;
         goto exit;
-
     }
-
-    data_ptr->thread_complete_success = false;
-    data_ptr->thread_mutex = &thread_mutex;
-    /* create thread for timer */
-    if (SUCCESS != pthread_create(&data_ptr->thread_id, NULL, start_timer_thread, data_ptr))
+    /* one context per connection plus one for the timer thread */
+    if (SUCCESS != pool_init(pool_size + (backend->timestamps ? 1 : 0)))
     {
-        syslog(LOG_PERROR, "pthread_create: %s", strerror(errno));
-        free(data_ptr);
-        data_ptr = NULL;
         status = FAILURE;
         goto exit;
-    } 
-    SLIST_INSERT_HEAD(&head, data_ptr, node_count);
-#endif
+    }
+    if ((0 != budget_limit()) && (budget_used() + thread_stack_size > budget_limit()))
+    {
+        syslog(LOG_ERR, "Memory budget of %zu bytes is below the %zu bytes of the connection pool",
+               budget_limit(), budget_used());
+        status = FAILURE;
+        goto exit;
+    }
+    /* create node for timer thread when the backend keeps timestamps */
+    if (backend->timestamps)
+    {
+        data_ptr = pool_get();
+        if (NULL == data_ptr)
+        {
+            syslog(LOG_ERR, "No connection context left for the timer thread");
+            status = FAILURE;
+            goto exit;
+        }
+        /* create thread for timer */
+        if (SUCCESS != start_thread(data_ptr, start_timer_thread))
+        {
+            pool_put(data_ptr);
+            data_ptr = NULL;
+            status = FAILURE;
+            goto exit;
+        }
+        SLIST_INSERT_HEAD(&head, data_ptr, node_count);
+    }
     /* exit accepting connections once signal is received */
     while (!exit_condition)
     {
+        /* stop accepting while the memory budget is used up, clients wait in the backlog */
+        if (!budget_allows_connection(&head))
+        {
+            if (!accept_paused)
+            {
+                syslog(LOG_WARNING, "Memory budget of %zu bytes used up, pausing accept", budget_limit());
+                accept_paused = true;
+            }
+            nanosleep(&budget_wait, NULL);
+            continue;
+        }
+        if (accept_paused)
+        {
+            syslog(LOG_INFO, "Resuming accept with %zu bytes in use", budget_used());
+            accept_paused = false;
+        }
         /* accept the connection on the socket */
         int connection_fd = accept(socket_fd, (struct sockaddr *)&clientAddr, &clientAddrLen);
         if (FAILURE == connection_fd)
@@ -599,66 +1061,60 @@ int main(int argc, char* argv[])
         }
         else
         {
+            /* check whether threads exited if yes, join them and recycle their nodes */
+            reap_threads(&head);
+
+            /* take a socket node for the connection */
+            data_ptr = pool_get();
             /* converts binary ip address to string format */
-            if (NULL == inet_ntop(AF_INET, &(clientAddr.sin_addr), ClientIpAddr, INET_ADDRSTRLEN))
+            if (NULL == inet_ntop(AF_INET, &(clientAddr.sin_addr), peer_addr, INET_ADDRSTRLEN))
             {
                 syslog(LOG_PERROR, "inet_ntop: %s", strerror(errno));
+                peer_addr[0] = '\0';
             }
-            syslog(LOG_INFO, "Accepted connection from %s", ClientIpAddr);
-
-            /* create socket node for each connection */
-            data_ptr = (socket_node_t *)malloc(sizeof(socket_node_t));
             if (NULL == data_ptr)
             {
-                syslog(LOG_PERROR, "malloc: %s", strerror(errno));
-                status = FAILURE;
-                goto exit;
+                syslog(LOG_ERR, "All %ld connections in use, refusing connection from %s", pool_size,
+                       peer_addr);
+                close(connection_fd);
+                continue;
             }
+            memcpy(data_ptr->peer_addr, peer_addr, INET_ADDRSTRLEN);
+            syslog(LOG_INFO, "Accepted connection from %s", data_ptr->peer_addr);
 
             data_ptr->connection_fd = connection_fd;
-            data_ptr->thread_complete_success = false;
-            data_ptr->thread_mutex = &thread_mutex;
             /* create thread for each connection */
-            if (SUCCESS != pthread_create(&data_ptr->thread_id, NULL, recv_and_send_thread, data_ptr))
+            if (SUCCESS != start_thread(data_ptr, recv_and_send_thread))
             {
-                syslog(LOG_PERROR, "pthread_create: %s", strerror(errno));
-                free(data_ptr);
+                close(connection_fd);
+                pool_put(data_ptr);
                 data_ptr = NULL;
                 status = FAILURE;
                 goto exit;
             } 
             SLIST_INSERT_HEAD(&head, data_ptr, node_count);
         }
-        /* check whether thread exited if yes, join thread and remove from socket list */
-        data_ptr = NULL;
-        SLIST_FOREACH_SAFE(data_ptr, &head, node_count, data_ptr_temp)
-        {
-            if (data_ptr->thread_complete_success == true)
-            {
-                pthread_join(data_ptr->thread_id, NULL);
-                SLIST_REMOVE(&head, data_ptr, socket_node, node_count);
-                free(data_ptr);
-                data_ptr = NULL;
-            }
-        }
     }
 
 exit:
-    close_app();
-
-    /* delete timer node from socket list */
+    /* delete timer and connection nodes from socket list */
     while (!SLIST_EMPTY(&head))
     {
         data_ptr = SLIST_FIRST(&head);
         SLIST_REMOVE_HEAD(&head, node_count);
-        /* join timer thread */
-        pthread_join(data_ptr->thread_id, NULL);
-        free(data_ptr);
+        /* wake a connection thread waiting for its client, the descriptor stays open until
+         * join_thread so it still belongs to this connection */
+        if (-1 != data_ptr->connection_fd)
+        {
+            shutdown(data_ptr->connection_fd, SHUT_RDWR);
+        }
+        join_thread(data_ptr);
         data_ptr = NULL;
     }
-    /* destroy mutex */
-    pthread_mutex_destroy(&thread_mutex);
-
+    pool_destroy();
+    pthread_attr_destroy(&thread_attr);
+    /* backend storage is released once no thread uses it */
+    close_app();
     return status;
 }
 
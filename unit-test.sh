@@ -11,3 +11,10 @@ make clean
 make
 cd ..
 ./build/assignment-autotest/assignment-autotest
+rc=$?
+# Tests of the buffers shared with the driver, a failure fails the run
+./build/aesd-circular-buffer-test || rc=1
+./build/aesd-spmc-buffer-test || rc=1
+# Report circular buffer performance so regressions show up next to the test results
+./build/aesd-circular-buffer-bench
+exit $rc